@@ -31,7 +31,7 @@
 Configuration::Configuration()
 {
 	amsynthrc_fname = filesystem::get().config;
-	sample_rate = midi_channel = polyphony = xruns = 0;
+	sample_rate = midi_channel = polyphony = voice_budget = voice_inaudible_threshold = oversampling = xruns = 0;
 #ifdef ENABLE_REALTIME
 	realtime = 0;
 #endif
@@ -52,8 +52,14 @@ Configuration::Defaults	()
 	channels = 2;
 	buffer_size = 128;
 	polyphony = 10;
+	voice_budget = 0;
+	voice_inaudible_threshold = -90;
+	oversampling = 1;
 	pitch_bend_range = 2;
 	jack_autoconnect = true;
+	multitimbral = false;
+	multitimbral_outputs = "summed";
+	multitimbral_shared_reverb = true;
 	jack_client_name_preference = "amsynth";
 	current_bank_file = filesystem::get().default_bank;
 	current_tuning_file = "default";
@@ -98,6 +104,15 @@ Configuration::load	()
 		} else if (buffer=="polyphony"){
 			file >> buffer;
 			std::istringstream(buffer) >> polyphony;
+		} else if (buffer=="voice_budget"){
+			file >> buffer;
+			std::istringstream(buffer) >> voice_budget;
+		} else if (buffer=="voice_inaudible_threshold"){
+			file >> buffer;
+			std::istringstream(buffer) >> voice_inaudible_threshold;
+		} else if (buffer=="oversampling"){
+			file >> buffer;
+			std::istringstream(buffer) >> oversampling;
 		} else if (buffer=="pitch_bend_range"){
 			file >> buffer;
 			std::istringstream(buffer) >> pitch_bend_range;
@@ -110,6 +125,15 @@ Configuration::load	()
 		} else if (buffer == "jack_autoconnect") {
 			file >> buffer;
 			jack_autoconnect = (buffer == "true");
+		} else if (buffer == "multitimbral") {
+			file >> buffer;
+			multitimbral = (buffer == "true");
+		} else if (buffer == "multitimbral_outputs") {
+			file >> buffer;
+			multitimbral_outputs = buffer;
+		} else if (buffer == "multitimbral_shared_reverb") {
+			file >> buffer;
+			multitimbral_shared_reverb = (buffer == "true");
 		} else {
 			file >> buffer;
 		}
@@ -131,10 +155,16 @@ Configuration::save	()
 	fprintf (fout, "alsa_audio_device\t%s\n", alsa_audio_device.c_str());
 	fprintf (fout, "sample_rate\t%d\n", sample_rate);
 	fprintf (fout, "polyphony\t%d\n", polyphony);
+	fprintf (fout, "voice_budget\t%d\n", voice_budget);
+	fprintf (fout, "voice_inaudible_threshold\t%d\n", voice_inaudible_threshold);
+	fprintf (fout, "oversampling\t%d\n", oversampling);
 	fprintf (fout, "pitch_bend_range\t%d\n", pitch_bend_range);
 	fprintf (fout, "tuning_file\t%s\n", current_tuning_file.c_str());
 	fprintf (fout, "ignored_parameters\t%s\n", ignored_parameters.c_str());
 	fprintf (fout, "jack_autoconnect\t%s\n", jack_autoconnect ? "true" : "false");
+	fprintf (fout, "multitimbral\t%s\n", multitimbral ? "true" : "false");
+	fprintf (fout, "multitimbral_outputs\t%s\n", multitimbral_outputs.c_str());
+	fprintf (fout, "multitimbral_shared_reverb\t%s\n", multitimbral_shared_reverb ? "true" : "false");
 	fclose (fout);
 	return 0;
 }
@@ -80,6 +80,21 @@ public:
 	 * unlimited polyphony.
 	 */
 	int polyphony;
+	/**
+	 * The maximum number of voices playing across all amsynth instances in
+	 * a process, e.g. several plugin instances in one host. 0 = unlimited.
+	 */
+	int voice_budget;
+	/**
+	 * Released voices are stopped early once their output falls below this
+	 * level in dBFS. Set to 0 to play releases until they are fully silent.
+	 */
+	int voice_inaudible_threshold;
+	/**
+	 * Factor (1, 2 or 4) by which the oscillators, filter and distortion are
+	 * oversampled to reduce aliasing. 1 = no oversampling.
+	 */
+	int oversampling;
 	/*
 	 */
 	int pitch_bend_range;
@@ -121,6 +136,18 @@ public:
 	
 	bool jack_autoconnect;
 
+	/**
+	 * Run 16 parts, one per MIDI channel, in a single process. With
+	 * multitimbral_outputs set to "separate" each part also gets its own
+	 * pair of JACK ports, otherwise only the summed output is provided.
+	 */
+	bool multitimbral;
+	std::string multitimbral_outputs;
+	/**
+	 * Use one reverb for all parts rather than one per part
+	 */
+	bool multitimbral_shared_reverb;
+
 	/* internal */
 	std::string	jack_client_name;
 	std::string	jack_client_name_preference;
@@ -0,0 +1,131 @@
+/*
+ *  FileWatcher.cpp
+ *
+ *  Copyright (c) 2023 Nick Dowell
+ *
+ *  This file is part of amsynth.
+ *
+ *  amsynth is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  amsynth is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with amsynth.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FileWatcher.h"
+
+#ifdef __linux__
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+FileWatcher::FileWatcher(Callback callback)
+: callback_(std::move(callback))
+{
+#ifdef __linux__
+	fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd_ == -1)
+		return;
+	if (pipe2(wakeFds_, O_CLOEXEC) == -1) {
+		close(fd_);
+		fd_ = -1;
+		return;
+	}
+	thread_ = std::thread(&FileWatcher::run, this);
+#endif
+}
+
+FileWatcher::~FileWatcher()
+{
+#ifdef __linux__
+	if (thread_.joinable()) {
+		char c = 0;
+		while (write(wakeFds_[1], &c, 1) == -1 && errno == EINTR);
+		thread_.join();
+	}
+	if (fd_ != -1)
+		close(fd_);
+	for (int fd : wakeFds_)
+		if (fd != -1)
+			close(fd);
+#endif
+}
+
+bool FileWatcher::watch(const std::string &directory)
+{
+#ifdef __linux__
+	if (fd_ == -1)
+		return false;
+	int wd = inotify_add_watch(fd_, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE);
+	if (wd == -1)
+		return false;
+	std::lock_guard<std::mutex> lock(mutex_);
+	directories_[wd] = directory;
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool FileWatcher::isWatching(const std::string &path)
+{
+	std::string::size_type pos = path.find_last_of('/');
+	if (pos == std::string::npos)
+		return false;
+	std::lock_guard<std::mutex> lock(mutex_);
+	for (const auto &it : directories_)
+		if (path.compare(0, pos, it.second) == 0 && it.second.size() == pos)
+			return true;
+	return false;
+}
+
+void FileWatcher::run()
+{
+#ifdef __linux__
+	alignas(struct inotify_event) char buffer[4096];
+	while (true) {
+		struct pollfd fds[2] = {{fd_, POLLIN, 0}, {wakeFds_[0], POLLIN, 0}};
+		if (poll(fds, 2, -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			return;
+		}
+		if (fds[1].revents)
+			return;
+
+		ssize_t length = read(fd_, buffer, sizeof(buffer));
+		if (length <= 0)
+			continue;
+
+		for (char *ptr = buffer; ptr < buffer + length; ) {
+			const struct inotify_event *event = (const struct inotify_event *) ptr;
+			ptr += sizeof(struct inotify_event) + event->len;
+			if (event->mask & IN_Q_OVERFLOW) {
+				callback_(std::string());
+				continue;
+			}
+			if (!event->len)
+				continue;
+			std::string path;
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				auto it = directories_.find(event->wd);
+				if (it == directories_.end())
+					continue;
+				path = it->second + "/" + event->name;
+			}
+			callback_(path);
+		}
+	}
+#endif
+}
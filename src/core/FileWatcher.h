@@ -0,0 +1,63 @@
+/*
+ *  FileWatcher.h
+ *
+ *  Copyright (c) 2023 Nick Dowell
+ *
+ *  This file is part of amsynth.
+ *
+ *  amsynth is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  amsynth is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with amsynth.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AMSYNTH_FILEWATCHER_H
+#define AMSYNTH_FILEWATCHER_H
+
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Watches directories for files being written, created, renamed or deleted.
+// The callback is invoked on a background thread with the path of the file,
+// or with an empty path if changes were lost because too many happened at
+// once, in which case anything in the watched directories may have changed.
+// Only implemented on Linux (inotify); elsewhere watch() always returns false.
+class FileWatcher
+{
+public:
+	typedef std::function<void(const std::string &path)> Callback;
+
+	explicit FileWatcher(Callback callback);
+	~FileWatcher();
+
+	FileWatcher(const FileWatcher &) = delete;
+	FileWatcher & operator=(const FileWatcher &) = delete;
+
+	bool watch(const std::string &directory);
+
+	// Returns true if changes to the file at `path` will be reported
+	bool isWatching(const std::string &path);
+
+private:
+	void run();
+
+	Callback callback_;
+	int fd_ = -1;
+	int wakeFds_[2] = {-1, -1};
+	std::thread thread_;
+	std::mutex mutex_;
+	std::map<int, std::string> directories_;
+};
+
+#endif //AMSYNTH_FILEWATCHER_H
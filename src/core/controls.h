@@ -86,6 +86,13 @@ typedef enum {
 	
 	kAmsynthParameter_PortamentoMode           = 40,
 
+	kAmsynthParameter_UnisonVoices             = 41,
+	kAmsynthParameter_UnisonDetune             = 42,
+	kAmsynthParameter_UnisonSpread             = 43,
+
+	kAmsynthParameter_VoicePanSpread           = 44,
+	kAmsynthParameter_VoicePanMode             = 45,
+
 	kAmsynthParameterCount
 } Param;
 
@@ -100,6 +107,12 @@ typedef enum {
 	PortamentoModeLegato
 } PortamentoMode;
 
+typedef enum {
+	VoicePanModeKey,
+	VoicePanModeVelocity,
+	VoicePanModeRandom
+} VoicePanMode;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -108,6 +121,7 @@ void get_parameter_properties(int parameter_index, double *minimum, double *maxi
 
 const char *parameter_name_from_index (int param_index);
 int parameter_index_from_name (const char *param_name);
+int parameter_index_from_name_len (const char *param_name, size_t length);
 
 int parameter_get_display (int parameter_index, float parameter_value, char *buffer, size_t maxlen);
 const char **parameter_get_value_strings (int parameter_index);
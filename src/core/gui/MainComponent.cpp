@@ -145,11 +145,20 @@ struct MainComponent::Impl : private juce::Timer {
 	}
 
 	void timerCallback() final {
+		if (banksChangeCount_ != PresetController::getBanksChangeCount()) {
+			// bank files were changed by another instance
+			banksChangeCount_ = PresetController::getBanksChangeCount();
+			PresetController::rescanPresetBanks();
+			presetController_->loadPresets();
+			populateBankCombo();
+			populatePresetCombo();
+		}
 		updateSaveButton();
 	}
 
 	void updateSaveButton() {
-		saveButton_.setEnabled(currentBankIsWritable_ && presetController_->isCurrentPresetModified());
+		bool modified = status_ ? status_->presetModified.load(std::memory_order_relaxed) : presetController_->isCurrentPresetModified();
+		saveButton_.setEnabled(currentBankIsWritable_ && modified);
 	}
 
 	void propertyChanged(const std::string &name, const std::string &value) {
@@ -166,14 +175,14 @@ struct MainComponent::Impl : private juce::Timer {
 			}
 		}
 		if (name == PROP_NAME(preset_name)) {
-			presetController_->getCurrentPreset().setName(value);
+			presetController_->setCurrentPresetName(value);
 			updatePresetComboLabelText();
 		}
 		if (name == PROP_NAME(preset_number) && !value.empty()) {
 			auto presetName = presetController_->getCurrentPreset().getName();
 			int presetNumber = std::stoi(value);
 			presetController_->setCurrPresetNumber(presetNumber);
-			presetController_->getCurrentPreset().setName(presetName);
+			presetController_->setCurrentPresetName(presetName);
 			// Don't call selectPreset() because that would change the parameter values
 			presetCombo_.setSelectedItemIndex(presetNumber, juce::NotificationType::dontSendNotification);
 			updatePresetComboLabelText();
@@ -314,7 +323,7 @@ struct MainComponent::Impl : private juce::Timer {
 		auto &name = presetController_->getCurrentPreset().getName();
 		showTextAlert(GETTEXT("Rename Preset"), GETTEXT("Rename"), name, [this](std::string text) {
 			if (presetController_->getCurrentPreset().getName() != text) {
-				presetController_->getCurrentPreset().setName(text);
+				presetController_->setCurrentPresetName(text);
 				setProperty(PROP_NAME(preset_name), text.c_str());
 				auto label = dynamic_cast<juce::Label *>(presetCombo_.getChildComponent(0));
 				label->setText(std::to_string(presetController_->getCurrPresetNumber() + 1) + ": " + text,
@@ -432,7 +441,7 @@ struct MainComponent::Impl : private juce::Timer {
 		for (const auto &bank : PresetController::getPresetBanks())
 			if (bank.file_path == presetController_->getFilePath())
 				for (int i = 0; i < PresetController::kNumPresets; i++)
-					presetCombo_.addItem(std::to_string(i + 1) + ": " + bank.presets[i].getName(), i + 1);
+					presetCombo_.addItem(std::to_string(i + 1) + ": " + bank.getPreset(i).getName(), i + 1);
 		presetCombo_.setSelectedItemIndex(presetController_->getCurrPresetNumber(),
 										  juce::NotificationType::dontSendNotification);
 		presetCombo_.onChange = [this] {
@@ -496,6 +505,8 @@ struct MainComponent::Impl : private juce::Timer {
 	juce::AlertWindow *alertWindow_{nullptr};
 	LookAndFeel lookAndFeel_;
 	bool currentBankIsWritable_ {false};
+	const SynthStatus *status_ {nullptr};
+	unsigned banksChangeCount_ {PresetController::getBanksChangeCount()};
 };
 
 MainComponent::MainComponent(PresetController *presetController, MidiController *midiController)
@@ -522,6 +533,10 @@ MainComponent::~MainComponent() {
 	setLookAndFeel(nullptr);
 }
 
+void MainComponent::setStatus(const SynthStatus *status) {
+	impl_->status_ = status;
+}
+
 void MainComponent::getAllCommands(juce::Array<juce::CommandID> &commands) {
 	commands.add(juce::StandardApplicationCommandIDs::copy);
 	commands.add(juce::StandardApplicationCommandIDs::paste);
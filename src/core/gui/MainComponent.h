@@ -45,6 +45,10 @@ public:
 	// At startup, receives property values from the Synthesizer.
 	void propertyChanged(const char *name, const char *value);
 
+	// When set, the save button follows the status published by the audio
+	// thread instead of comparing the preset on every timer tick.
+	void setStatus(const struct SynthStatus *status);
+
 	bool isPlugin {true};
 
 private:
@@ -50,6 +50,7 @@ public:
 	void	triggerOff	();
 
 	int		getState	() { return (m_state == State::kOff) ? 0 : 1; };
+	bool	isReleased	() const { return m_state == State::kRelease || m_state == State::kOff; }
 
 	/**
 	 * puts the envelope directly into the off (ADSR_OFF) state, without
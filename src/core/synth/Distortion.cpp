@@ -28,17 +28,66 @@ Distortion::SetCrunch	(float value)
 	crunch=1-value;
 }
 
+static inline float
+distort	(float x, float c)
+{
+	float s;
+	if(x<0) s=-1; else s=1;
+	x*=s;
+	x = pow (x, c < 0.01f ? 0.01f : c);
+	return x*s;
+}
+
+void
+Distortion::setOversampling	(int factor)
+{
+	mOversamplerLeft.setFactor(factor);
+	mOversamplerRight.setFactor(factor);
+}
+
 void
 Distortion::Process	(float *buffer, unsigned nframes)
 {
-	float x, s;
+	if (mOversamplerLeft.getFactor() == 1) {
+		for (unsigned i=0; i<nframes; i++)
+		{
+			float c = crunch.tick();
+			buffer[i] = distort(buffer[i], c);
+		}
+		return;
+	}
+
 	for (unsigned i=0; i<nframes; i++)
-	{
-		x = buffer[i];
-		if(x<0) s=-1; else s=1;
-		x*=s;
-		float c = crunch.tick();
-		x = pow (x, c < 0.01f ? 0.01f : c);
-		buffer[i] = x*s;
+		mCrunch[i] = crunch.tick();
+	process(buffer, mOversamplerLeft, nframes, mCrunch);
+}
+
+void
+Distortion::Process	(float *left, float *right, unsigned nframes)
+{
+	if (mOversamplerLeft.getFactor() == 1) {
+		for (unsigned i=0; i<nframes; i++)
+		{
+			float c = crunch.tick();
+			left[i] = distort(left[i], c);
+			right[i] = distort(right[i], c);
+		}
+		return;
 	}
+
+	for (unsigned i=0; i<nframes; i++)
+		mCrunch[i] = crunch.tick();
+	process(left, mOversamplerLeft, nframes, mCrunch);
+	process(right, mOversamplerRight, nframes, mCrunch);
+}
+
+void
+Distortion::process	(float *buffer, Oversampler &oversampler, unsigned nframes, float *crunchValues)
+{
+	const unsigned factor = oversampler.getFactor();
+	oversampler.upsample(buffer, mOversampled, nframes);
+	for (unsigned i=0; i<nframes; i++)
+		for (unsigned j=0; j<factor; j++)
+			mOversampled[i * factor + j] = distort(mOversampled[i * factor + j], crunchValues[i]);
+	oversampler.downsample(mOversampled, buffer, nframes);
 }
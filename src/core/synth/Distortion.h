@@ -22,6 +22,7 @@
 #ifndef _DISTORTION_H
 #define _DISTORTION_H
 
+#include "Oversampler.h"
 #include "Synth--.h"
 
 /**
@@ -32,8 +33,20 @@ class Distortion
 public:
 	void	SetCrunch		(float);
 	void	Process			(float *buffer, unsigned);
+	void	Process			(float *left, float *right, unsigned);
+
+	// Waveshapes at a multiple of the sample rate to reduce aliasing
+	void	setOversampling	(int factor);
+	float	getLatency		() const { return 2 * mOversamplerLeft.getLatency(); }
+
 private:
+	void	process			(float *buffer, Oversampler &, unsigned, float *crunchValues);
+
 	SmoothedParam crunch{1};
+	Oversampler	mOversamplerLeft;
+	Oversampler	mOversamplerRight;
+	float	mCrunch[Oversampler::kMaxFrames];
+	float	mOversampled[Oversampler::kMaxFrames * Oversampler::kMaxFactor];
 };
 
 #endif
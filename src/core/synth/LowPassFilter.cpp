@@ -26,10 +26,168 @@
 #include <cassert>
 #include <math.h>
 
+//
+// Cached values of tan(pi * w) for normalised cutoffs 0 <= w < 0.5, so the
+// per-block coefficient update does not need to call tanf for every voice.
+// Adjacent entries are linearly interpolated; the error is below 1e-7
+// relative up to a few kHz and only grows to ~1% in the last octave before
+// nyquist, where it is inaudible next to the filter's own warping.
+//
+static const int kTanTableSize = 4096;
+
+static const struct TanTable
+{
+	float values[kTanTableSize];
+
+	TanTable()
+	{
+		for (int i = 0; i < kTanTableSize; i++)
+			values[i] = (float) tan(m::pi * 0.5 * i / kTanTableSize);
+	}
+
+	float operator()(float w) const
+	{
+		const float x = w * 2.f * kTanTableSize;
+		const int i = std::min((int) x, kTanTableSize - 2);
+		const float frac = x - (float) i;
+		return values[i] + frac * (values[i + 1] - values[i]);
+	}
+} tanTable;
+
+template <int N>
+void
+SynthFilterLanes<N>::reset()
+{
+	for (int lane = 0; lane < N; lane++)
+		s1[lane] = s2[lane] = s3[lane] = s4[lane] = 0;
+}
+
+template <int N>
+void
+SynthFilterLanes<N>::setCutoff(int lane, float cutoff, float res, float maxCutoff)
+{
+	cutoff = std::min(cutoff, nyquist * maxCutoff);
+	cutoff = std::max(cutoff, 10.0f);
+
+	const float g = tanTable(cutoff / rate);
+	const float r = std::max(0.001f, 2.f * (1.f - res)); // r is 1/Q (sqrt(2) for a butterworth response)
+	const float a1 = 1.f / (1.f + g * (g + r));
+	const float a2 = g * a1;
+	const float a3 = g * a2;
+	c1[lane] = 2.f * a1 - 1.f;
+	c2[lane] = 2.f * a2;
+	c3[lane] = 2.f * a3;
+	k[lane] = r;
+}
+
+//
+// Trapezoidal integrated state variable filter, after "Solving the continuous
+// SVF equations using trapezoidal integration and equivalent currents" by
+// Andrew Simper. The feedback path has no unit delay, so it stays stable up to
+// nyquist and when the cutoff jumps between blocks, and float precision is
+// sufficient because the states are integrator outputs rather than
+// direct-form accumulators (a float direct form biquad is off by >1% at 20Hz).
+//
+template <typename Mode, Mode mode>
+static inline float svfTick(float x, float &ic1, float &ic2, float c1, float c2, float c3, float k)
+{
+	// ic2 is updated by adding to it, as an integrator, to keep precision at
+	// low cutoffs where c2 and c3 are tiny. Terms are grouped so that each
+	// state's feedback loop is only three operations long.
+	const float ic1n = c1 * ic1 + c2 * (x - ic2);
+	const float ic2n = (ic2 - c3 * ic2) + (c2 * ic1 + c3 * x);
+	const float v1 = 0.5f * (ic1 + ic1n);
+	const float v2 = 0.5f * (ic2 + ic2n);
+	ic1 = ic1n;
+	ic2 = ic2n;
+	switch (mode) {
+		case Mode::kLowPass:  return v2;
+		case Mode::kHighPass: return x - k * v1 - v2;
+		case Mode::kBandPass: return k * v1;     // unity gain at the centre frequency
+		default:              return x - k * v1; // band stop
+	}
+}
+
+// The lane loops are innermost and work on local copies of the state so the
+// compiler can keep each array in a vector register.
+template <int N, typename Mode, Mode mode, bool cascade>
+static void svfProcess(float *buffer, int numFrames,
+                       const float *c1, const float *c2, const float *c3, const float *k,
+                       float *s1, float *s2, float *s3, float *s4)
+{
+	float ic1[N], ic2[N], ic3[N], ic4[N];
+	for (int lane = 0; lane < N; lane++) {
+		ic1[lane] = s1[lane]; ic2[lane] = s2[lane]; ic3[lane] = s3[lane]; ic4[lane] = s4[lane];
+	}
+	for (int i = 0; i < numFrames; i++) {
+		float *frame = buffer + i * N;
+		for (int lane = 0; lane < N; lane++) {
+			float y = svfTick<Mode, mode>(frame[lane], ic1[lane], ic2[lane], c1[lane], c2[lane], c3[lane], k[lane]);
+			if (cascade)
+				y = svfTick<Mode, mode>(y, ic3[lane], ic4[lane], c1[lane], c2[lane], c3[lane], k[lane]);
+			frame[lane] = y;
+		}
+	}
+	for (int lane = 0; lane < N; lane++) {
+		s1[lane] = ic1[lane]; s2[lane] = ic2[lane]; s3[lane] = ic3[lane]; s4[lane] = ic4[lane];
+	}
+}
+
+template <int N>
+void
+SynthFilterLanes<N>::ProcessSamples(float *buffer, int numFrames, Mode mode, bool cascade)
+{
+#define PROCESS(MODE) \
+	if (cascade) svfProcess<N, Mode, MODE, true >(buffer, numFrames, c1, c2, c3, k, s1, s2, s3, s4); \
+	else         svfProcess<N, Mode, MODE, false>(buffer, numFrames, c1, c2, c3, k, s1, s2, s3, s4);
+
+	switch (mode) {
+		case Mode::kLowPass:  PROCESS(Mode::kLowPass);  break;
+		case Mode::kHighPass: PROCESS(Mode::kHighPass); break;
+		case Mode::kBandPass: PROCESS(Mode::kBandPass); break;
+		case Mode::kBandStop: PROCESS(Mode::kBandStop); break;
+	}
+#undef PROCESS
+}
+
+template class SynthFilterLanes<1>;
+template class SynthFilterLanes<4>;
+template class SynthFilterLanes<8>;
+
 void
 SynthFilter::reset()
 {
 	d1 = d2 = d3 = d4 = 0;
+	lanes.reset();
+}
+
+void
+SynthFilter::processSVF(float *buffer, int numSamples, float cutoff, float res, Type type, Slope slope)
+{
+	using Mode = SynthFilterLanes<1>::Mode;
+
+	Mode mode;
+	switch (type) {
+		case Type::kSVFLowPass:  mode = Mode::kLowPass; break;
+		case Type::kSVFHighPass: mode = Mode::kHighPass; break;
+		case Type::kSVFBandPass: mode = Mode::kBandPass; break;
+		case Type::kSVFBandStop: mode = Mode::kBandStop; break;
+		default:
+			assert(nullptr == "invalid FilterType");
+			return;
+	}
+
+	switch (slope) {
+		case Slope::k12:
+		case Slope::k24:
+			break;
+		default:
+			assert(nullptr == "invalid FilterSlope");
+			return;
+	}
+
+	lanes.setCutoff(0, cutoff, res);
+	lanes.ProcessSamples(buffer, numSamples, mode, slope == Slope::k24);
 }
 
 void
@@ -38,6 +196,11 @@ SynthFilter::ProcessSamples(float *buffer, int numSamples, float cutoff, float r
 	if (type == Type::kBypass) {
 		return;
 	}
+
+	if (type >= Type::kSVFLowPass) {
+		processSVF(buffer, numSamples, cutoff, res, type, slope);
+		return;
+	}
 	
 	cutoff = std::min(cutoff, nyquist * 0.99f); // filter is unstable at PI
 	cutoff = std::max(cutoff, 10.0f);
@@ -22,6 +22,55 @@
 #ifndef _LOWPASSFILTER_H
 #define _LOWPASSFILTER_H
 
+/**
+ * @brief Several independent filters processed side by side.
+ *
+ * Buffers are interleaved frame by frame (buffer[frame * N + lane]) so each
+ * step of the recursion is computed for all lanes at once, which lets the
+ * compiler use SIMD registers for e.g. a group of voices. Every lane shares
+ * the type and slope but has its own cutoff and resonance.
+ *
+ * The filter is a trapezoidal integrated state variable filter in float.
+ * Its low pass, high pass, band pass and notch outputs have the same
+ * transfer functions as bilinear transform biquads, but keep their precision
+ * at low cutoffs and stay stable when the cutoff is modulated quickly.
+ */
+template <int N>
+class SynthFilterLanes
+{
+public:
+	enum class Mode {
+		kLowPass,
+		kHighPass,
+		kBandPass,
+		kBandStop,
+	};
+
+	void SetSampleRate(int rateIn) { rate = (float)rateIn; nyquist = rate / 2.0f; }
+
+	void reset();
+
+	// maxCutoff is a fraction of nyquist
+	void setCutoff(int lane, float cutoff, float res, float maxCutoff = 0.999f);
+
+	void ProcessSamples(float *, int numFrames, Mode mode, bool cascade);
+
+private:
+	float rate = 44100;
+	float nyquist = 22050.0;
+
+	float c1[N] = {};
+	float c2[N] = {};
+	float c3[N] = {};
+	float k[N] = {};
+
+	// integrator states of the two cascaded stages
+	float s1[N] = {};
+	float s2[N] = {};
+	float s3[N] = {};
+	float s4[N] = {};
+};
+
 class SynthFilter
 {
 public:
@@ -31,7 +80,14 @@ public:
 		kHighPass,
 		kBandPass,
 		kBandStop,
-		kBypass
+		kBypass,
+		// Zero-delay-feedback state variable filter responses. These are
+		// appended so that the values stored in existing presets keep their
+		// original meaning.
+		kSVFLowPass,
+		kSVFHighPass,
+		kSVFBandPass,
+		kSVFBandStop,
 	};
 
 	enum class Slope {
@@ -39,7 +95,7 @@ public:
 		k24,
 	};
 
-	void SetSampleRate(int rateIn) { rate = (float)rateIn; nyquist = rate / 2.0f; }
+	void SetSampleRate(int rateIn) { rate = (float)rateIn; nyquist = rate / 2.0f; lanes.SetSampleRate(rateIn); }
 
 	void reset();
 
@@ -47,12 +103,18 @@ public:
 
 private:
 
+	void processSVF(float *, int, float cutoff, float res, Type type, Slope slope);
+
+	// The classic types keep their double precision direct form biquads so
+	// that existing presets render exactly as before
 	float rate = 44100;
 	float nyquist = 22050.0;
 	double d1 = 0;
 	double d2 = 0;
 	double d3 = 0;
 	double d4 = 0;
+
+	SynthFilterLanes<1> lanes;
 };
 
 #endif
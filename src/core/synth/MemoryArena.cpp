@@ -0,0 +1,104 @@
+/*
+ *  MemoryArena.cpp
+ *
+ *  Copyright (c) 2023 Nick Dowell
+ *
+ *  This file is part of amsynth.
+ *
+ *  amsynth is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  amsynth is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with amsynth.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "MemoryArena.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+static const size_t kHugePageSize = 2 * 1024 * 1024;
+
+MemoryArena::MemoryArena(size_t capacity)
+:	mData(nullptr)
+,	mCapacity(capacity)
+,	mUsed(0)
+,	mLocked(false)
+{
+	if (!mCapacity)
+		return;
+#ifdef _WIN32
+	mData = (char *)VirtualAlloc(nullptr, mCapacity, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	if (!mData)
+		throw std::bad_alloc();
+#else
+	void *data = mmap(nullptr, mCapacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (data == MAP_FAILED)
+		throw std::bad_alloc();
+	mData = (char *)data;
+#ifdef MADV_HUGEPAGE
+	if (mCapacity >= kHugePageSize)
+		madvise(mData, mCapacity, MADV_HUGEPAGE);
+#endif
+#endif
+}
+
+MemoryArena::~MemoryArena()
+{
+	if (!mData)
+		return;
+#ifdef _WIN32
+	if (mLocked)
+		VirtualUnlock(mData, mCapacity);
+	VirtualFree(mData, 0, MEM_RELEASE);
+#else
+	if (mLocked)
+		munlock(mData, mCapacity);
+	munmap(mData, mCapacity);
+#endif
+}
+
+void *
+MemoryArena::allocate(size_t size)
+{
+	size_t aligned = sizeFor(size);
+	if (aligned > mCapacity - mUsed)
+		return nullptr;
+	void *p = mData + mUsed;
+	mUsed += aligned;
+	return p;
+}
+
+int
+MemoryArena::lock()
+{
+	if (mLocked || !mData)
+		return 0;
+#ifdef _WIN32
+	if (!VirtualLock(mData, mCapacity)) {
+		fprintf(stderr, "amsynth: could not lock DSP memory (error %lu)\n", GetLastError());
+		return -1;
+	}
+#else
+	if (mlock(mData, mCapacity) != 0) {
+		fprintf(stderr, "amsynth: could not lock DSP memory: %s\n", strerror(errno));
+		return -1;
+	}
+#endif
+	mLocked = true;
+	return 0;
+}
@@ -0,0 +1,74 @@
+/*
+ *  MemoryArena.h
+ *
+ *  Copyright (c) 2023 Nick Dowell
+ *
+ *  This file is part of amsynth.
+ *
+ *  amsynth is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  amsynth is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with amsynth.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MEMORYARENA_H
+#define _MEMORYARENA_H
+
+#include <cstddef>
+#include <new>
+
+/*
+ * One contiguous block of memory that a fixed set of objects is carved from,
+ * so that the state touched while rendering is laid out together and can be
+ * locked into RAM with a single call. Nothing is freed until the arena is
+ * destroyed; objects created with create() must be passed to destroy() first.
+ *
+ * Large arenas are backed by transparent huge pages where the OS supports it.
+ */
+class MemoryArena
+{
+public:
+	static const size_t kAlignment = 64; // cache line
+
+	// Space taken by an allocation of size bytes, including alignment padding
+	static constexpr size_t sizeFor(size_t size) { return (size + kAlignment - 1) & ~(kAlignment - 1); }
+
+	explicit MemoryArena(size_t capacity);
+	~MemoryArena();
+
+	MemoryArena(const MemoryArena &) = delete;
+	MemoryArena & operator=(const MemoryArena &) = delete;
+
+	// Returns cache line aligned memory, or null if the arena is full
+	void *	allocate	(size_t size);
+
+	template <class T>
+	T *		create		() { void *p = allocate(sizeof(T)); return p ? new (p) T : nullptr; }
+
+	template <class T>
+	static void	destroy	(T *object) { if (object) object->~T(); }
+
+	bool	contains	(const void *p) const { return p >= mData && p < mData + mCapacity; }
+	size_t	getCapacity	() const { return mCapacity; }
+	size_t	getUsed		() const { return mUsed; }
+
+	// Prevents the arena from being paged out; returns 0 on success or -1 if
+	// the OS refused, e.g. because of RLIMIT_MEMLOCK
+	int		lock		();
+
+private:
+	char	*mData;
+	size_t	mCapacity;
+	size_t	mUsed;
+	bool	mLocked;
+};
+
+#endif
@@ -97,7 +97,7 @@ MidiController::HandleMidiData(const unsigned char* bytes, unsigned numBytes)
 		case MIDI_STATUS_PROGRAM_CHANGE:
 			if (!ignore && presetController->getCurrPresetNumber() != byte) {
 				if (_handler) _handler->HandleMidiAllSoundOff();
-				presetController->selectPreset((int) byte);
+				presetController->selectPresetRealtime((int) byte);
 			}
 			data = 0xff;
 			break;
@@ -129,16 +129,16 @@ MidiController::HandleMidiData(const unsigned char* bytes, unsigned numBytes)
 void
 MidiController::pitch_wheel_change(float val)
 {
-	if (_handler) _handler->HandleMidiPitchWheel(val);
+	if (_handler) _handler->HandleMidiPitchWheel(channel, val);
 }
 
 void
-MidiController::dispatch_note(unsigned char, unsigned char note, unsigned char vel)
+MidiController::dispatch_note(unsigned char ch, unsigned char note, unsigned char vel)
 {
 	static const float scale = 1.f/127.f;
     if (!_handler) return;
-	if (vel) _handler->HandleMidiNoteOn((int) note, (float)vel * scale);
-	else     _handler->HandleMidiNoteOff((int) note, (float)vel * scale);
+	if (vel) _handler->HandleMidiNoteOn((int) ch, (int) note, (float)vel * scale);
+	else     _handler->HandleMidiNoteOff((int) ch, (int) note, (float)vel * scale);
 }
 
 void
@@ -162,7 +162,7 @@ MidiController::controller_change(unsigned char cc, unsigned char value)
 	switch (cc) {
 		case MIDI_CC_BANK_SELECT_MSB: {
 			presetController->selectBank(value);
-			presetController->selectPreset(presetController->getCurrPresetNumber());
+			presetController->selectPresetRealtime(presetController->getCurrPresetNumber());
 			break;
 		}
 		case MIDI_CC_PAN_MSB: {
@@ -191,7 +191,7 @@ MidiController::controller_change(unsigned char cc, unsigned char value)
 			break;
 		case MIDI_CC_RESET_ALL_CONTROLLERS:
 			// https://web.archive.org/web/20160105110518/http://www.midi.org/techspecs/rp15.php
-			_handler->HandleMidiPitchWheel(0);
+			_handler->HandleMidiPitchWheel(channel, 0);
 			break;
 		case MIDI_CC_ALL_NOTES_OFF:
 			if (value == 0)
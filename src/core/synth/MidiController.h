@@ -34,9 +34,9 @@ typedef unsigned char uchar;
 class MidiEventHandler
 {
 public:
-	virtual void HandleMidiNoteOn(int /*note*/, float /*velocity*/) = 0;
-	virtual void HandleMidiNoteOff(int /*note*/, float /*velocity*/) = 0;
-	virtual void HandleMidiPitchWheel(float /*value*/) = 0;
+	virtual void HandleMidiNoteOn(int /*channel*/, int /*note*/, float /*velocity*/) = 0;
+	virtual void HandleMidiNoteOff(int /*channel*/, int /*note*/, float /*velocity*/) = 0;
+	virtual void HandleMidiPitchWheel(int /*channel*/, float /*value*/) = 0;
 	virtual void HandleMidiPitchWheelSensitivity(uchar semitones) = 0;
 	virtual void HandleMidiAllSoundOff() = 0;
 	virtual void HandleMidiAllNotesOff() = 0;
@@ -0,0 +1,183 @@
+/*
+ *  MultitimbralSynthesizer.cpp
+ *
+ *  Copyright (c) 2023 Nick Dowell
+ *
+ *  This file is part of amsynth.
+ *
+ *  amsynth is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  amsynth is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with amsynth.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "MultitimbralSynthesizer.h"
+
+#include "SoftLimiter.h"
+#include "Synthesizer.h"
+#include "VoiceAllocationUnit.h"
+#include "freeverb/revmodel.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+
+MultitimbralSynthesizer::MultitimbralSynthesizer()
+: _arena(MemoryArena::sizeFor(sizeof(revmodel)) + MemoryArena::sizeFor(sizeof(SoftLimiter)))
+, _reverb(_arena.create<revmodel>())
+, _limiter(_arena.create<SoftLimiter>())
+, _reverbSettings{-1, -1, -1}
+{
+	for (int i = 0; i < kNumParts; i++) {
+		_parts[i] = new Synthesizer;
+		_parts[i]->setMidiChannel((unsigned char) (i + 1));
+		_parts[i]->_voiceAllocationUnit->setVoiceBudget(&_voiceBudget);
+	}
+	_reverb->setwet(1);
+	_reverb->setdry(0);
+	_events.reserve(256);
+}
+
+MultitimbralSynthesizer::~MultitimbralSynthesizer()
+{
+	for (int i = 0; i < kNumParts; i++)
+		delete _parts[i];
+	MemoryArena::destroy(_reverb);
+	MemoryArena::destroy(_limiter);
+}
+
+int MultitimbralSynthesizer::lockMemory()
+{
+	int result = _arena.lock();
+	for (int i = 0; i < kNumParts; i++)
+		if (_parts[i]->lockMemory() != 0)
+			result = -1;
+	return result;
+}
+
+void MultitimbralSynthesizer::setSharedReverb(bool shared)
+{
+	if (_sharedReverb == shared)
+		return;
+	_sharedReverb = shared;
+	for (int i = 0; i < kNumParts; i++)
+		_parts[i]->_voiceAllocationUnit->setMasterEffectsEnabled(!shared);
+	_reverb->mute();
+}
+
+void MultitimbralSynthesizer::setPartPriority(int part, int priority)
+{
+	_parts[part]->_voiceAllocationUnit->setVoicePriority(priority);
+}
+
+void MultitimbralSynthesizer::setPartReservedVoices(int part, int voices)
+{
+	_parts[part]->_voiceAllocationUnit->setReservedVoices(voices);
+}
+
+void MultitimbralSynthesizer::setSampleRate(int sampleRate)
+{
+	for (int i = 0; i < kNumParts; i++)
+		_parts[i]->setSampleRate(sampleRate);
+	_reverb->setrate(sampleRate);
+	_limiter->SetSampleRate(sampleRate);
+}
+
+void MultitimbralSynthesizer::updateReverb()
+{
+	// The shared reverb takes its room settings from the first part
+	Synthesizer *part = _parts[0];
+	float roomSize = part->getParameterValue(kAmsynthParameter_ReverbRoomsize);
+	float damp = part->getParameterValue(kAmsynthParameter_ReverbDamp);
+	float width = part->getParameterValue(kAmsynthParameter_ReverbWidth);
+	if (_reverbSettings[0] != roomSize) _reverb->setroomsize(_reverbSettings[0] = roomSize);
+	if (_reverbSettings[1] != damp) _reverb->setdamp(_reverbSettings[1] = damp);
+	if (_reverbSettings[2] != width) _reverb->setwidth(_reverbSettings[2] = width);
+}
+
+void MultitimbralSynthesizer::process(unsigned nframes,
+									  const std::vector<amsynth_midi_event_t> &midi_in,
+									  std::vector<amsynth_midi_cc_t> &midi_out,
+									  float *audio_l, float *audio_r, unsigned audio_stride,
+									  float **parts_l, float **parts_r)
+{
+	auto event = midi_in.begin();
+	for (unsigned offset = 0; offset < nframes;) {
+		const unsigned frames = std::min(nframes - offset, kBlockSize);
+		const bool lastBlock = offset + frames == nframes;
+
+		// Every part sees every event and filters by its own MIDI channel,
+		// since an event may hold several messages using running status
+		_events.clear();
+		for (; event != midi_in.end() && (lastBlock || event->offset_frames < offset + frames); ++event) {
+			amsynth_midi_event_t e = *event;
+			e.offset_frames = e.offset_frames > offset ? e.offset_frames - offset : 0;
+			_events.push_back(e);
+		}
+
+		memset(_mixL, 0, frames * sizeof(float));
+		memset(_mixR, 0, frames * sizeof(float));
+
+		if (_sharedReverb) {
+			updateReverb();
+			memset(_sendL, 0, frames * sizeof(float));
+			memset(_sendR, 0, frames * sizeof(float));
+		}
+
+		// Without a reverb send or separate outputs, the parts can mix
+		// straight into the bus
+		const bool accumulate = !_sharedReverb && !(parts_l && parts_r);
+
+		for (int p = 0; p < kNumParts; p++) {
+			Synthesizer *part = _parts[p];
+			part->setAccumulate(accumulate);
+			if (accumulate) {
+				part->process(frames, _events, midi_out, _mixL, _mixR);
+				continue;
+			}
+			part->process(frames, _events, midi_out, _partL, _partR);
+
+			if (_sharedReverb) {
+				// Matches the level of the dry signal mixed in by a part's own reverb
+				const float send = part->getParameterValue(kAmsynthParameter_ReverbWet);
+				const float dry = 2.f - send;
+				for (unsigned i = 0; i < frames; i++) {
+					_sendL[i] += _partL[i] * send;
+					_sendR[i] += _partR[i] * send;
+					_partL[i] *= dry;
+					_partR[i] *= dry;
+				}
+			}
+
+			for (unsigned i = 0; i < frames; i++) {
+				_mixL[i] += _partL[i];
+				_mixR[i] += _partR[i];
+			}
+
+			if (parts_l && parts_r) {
+				memcpy(parts_l[p] + offset, _partL, frames * sizeof(float));
+				memcpy(parts_r[p] + offset, _partR, frames * sizeof(float));
+			}
+		}
+
+		if (_sharedReverb) {
+			_reverb->processmix(_sendL, _sendR, _mixL, _mixR, frames, 1);
+			_limiter->Process(_mixL, _mixR, frames);
+		}
+
+		for (unsigned i = 0; i < frames; i++) {
+			audio_l[(offset + i) * audio_stride] = _mixL[i];
+			audio_r[(offset + i) * audio_stride] = _mixR[i];
+		}
+
+		offset += frames;
+	}
+}
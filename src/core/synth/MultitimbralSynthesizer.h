@@ -0,0 +1,102 @@
+/*
+ *  MultitimbralSynthesizer.h
+ *
+ *  Copyright (c) 2023 Nick Dowell
+ *
+ *  This file is part of amsynth.
+ *
+ *  amsynth is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  amsynth is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with amsynth.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __amsynth__MultitimbralSynthesizer__
+#define __amsynth__MultitimbralSynthesizer__
+
+#include "MemoryArena.h"
+#include "VoiceBoard.h"
+#include "VoiceBudget.h"
+
+#include "core/types.h"
+
+#include <vector>
+
+class Synthesizer;
+class SoftLimiter;
+class revmodel;
+
+/*
+ * Sixteen Synthesizer parts, each playing its own patch on one MIDI channel.
+ *
+ * The parts share a single polyphony budget and, optionally, a single reverb
+ * and limiter on the summed output in place of one per part.
+ */
+class MultitimbralSynthesizer
+{
+public:
+
+	static constexpr int kNumParts = 16;
+
+	MultitimbralSynthesizer();
+	~MultitimbralSynthesizer();
+
+	// Part n responds to MIDI channel n + 1
+	Synthesizer *getPart(int part) { return _parts[part]; }
+
+	int getMaxNumVoices() { return _voiceBudget.getMaxVoices(); }
+	void setMaxNumVoices(int value) { _voiceBudget.setMaxVoices(value); }
+
+	// See VoiceAllocationUnit::setVoicePriority()
+	void setPartPriority(int part, int priority);
+	void setPartReservedVoices(int part, int voices);
+
+	bool getSharedReverb() { return _sharedReverb; }
+	void setSharedReverb(bool);
+
+	void setSampleRate(int sampleRate);
+
+	// Locks the DSP state of every part and the shared effects into RAM;
+	// returns 0 on success
+	int lockMemory();
+
+	// Renders the sum of all parts to audio_l/audio_r. If parts_l/parts_r are
+	// given they must point to kNumParts non-interleaved buffers which receive
+	// each part's output; with a shared reverb the reverb is only present in
+	// the summed output.
+	void process(unsigned nframes,
+				 const std::vector<amsynth_midi_event_t> &midi_in,
+				 std::vector<amsynth_midi_cc_t> &midi_out,
+				 float *audio_l, float *audio_r, unsigned audio_stride = 1,
+				 float **parts_l = nullptr, float **parts_r = nullptr);
+
+private:
+
+	void updateReverb();
+
+	static constexpr unsigned kBlockSize = VoiceBoard::kMaxProcessBufferSize;
+
+	Synthesizer *_parts[kNumParts];
+	VoiceBudget _voiceBudget;
+
+	bool _sharedReverb = false;
+	MemoryArena _arena;
+	revmodel *_reverb;
+	SoftLimiter *_limiter;
+	float _reverbSettings[3];
+
+	std::vector<amsynth_midi_event_t> _events;
+	float _partL[kBlockSize], _partR[kBlockSize];
+	float _sendL[kBlockSize], _sendR[kBlockSize];
+	float _mixL[kBlockSize], _mixR[kBlockSize];
+};
+
+#endif /* defined(__amsynth__MultitimbralSynthesizer__) */
@@ -204,3 +204,130 @@ Oscillator::doNoise(float *buffer, int nFrames)
     for (int i = 0; i < nFrames; i++)
 		buffer[i] = randf();
 }
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Each copy's phase is computed directly from the number of frames elapsed in
+// the block, so there is no dependency between iterations and the frame loop
+// can be vectorised.
+template <typename Waveshaper>
+static inline float renderUnisonCopy(const Waveshaper &waveshaper, float *left, float *right, int nFrames,
+									 float phase, float ratio, float increment, float step, float gainL, float gainR)
+{
+	for (int i = 0; i < nFrames; i++) {
+		const float n = (float)(i + 1);
+		const float dt = ratio * (increment + step * (n - 1.f));
+		float t = phase + ratio * n * (increment + step * (n - 1.f) * 0.5f);
+		t -= (float)(int)t;
+		const float y = waveshaper(t, dt);
+		left[i] += y * gainL;
+		right[i] += y * gainR;
+	}
+	const float n = (float)nFrames;
+	const float t = phase + ratio * n * (increment + step * (n - 1.f) * 0.5f);
+	return t - (float)(int)t;
+}
+
+void
+UnisonOscillator::SetSampleRate(int rateIn)
+{
+	rate = rateIn;
+	mNoise.SetSampleRate(rateIn);
+}
+
+void
+UnisonOscillator::SetWaveform(Oscillator::Waveform w)
+{
+	waveform = w;
+	mNoise.SetWaveform(w);
+}
+
+void
+UnisonOscillator::setVoices(int voices, float detune, float spread)
+{
+	mVoices = std::min(std::max(voices, 1), kMaxVoices);
+	mGain = 1.f / sqrtf((float)mVoices);
+	for (int k = 0; k < mVoices; k++) {
+		const float position = mVoices > 1 ? 2.f * k / (mVoices - 1) - 1.f : 0.f;
+		mRatio[k] = powf(2.f, position * detune * 0.5f / 12.f);
+		// alternate sides so that neighbouring pitches are not bunched together
+		const float pan = (k & 1 ? -position : position) * spread;
+		mGainL[k] = mGain * (1.f - pan) / 2.f;
+		mGainR[k] = mGain * (1.f + pan) / 2.f;
+	}
+}
+
+void
+UnisonOscillator::reset()
+{
+	// fixed but irregular start phases avoid the copies cancelling at note on
+	for (int k = 0; k < kMaxVoices; k++) {
+		const float phase = k * 0.381966f;
+		mPhase[k] = phase - (float)(int)phase;
+	}
+	mNoise.reset();
+}
+
+void
+UnisonOscillator::ProcessSamples(float *left, float *right, int nFrames, float freq_hz, float pw)
+{
+	const float increment = std::min(freq_hz, rate / 2.f) / rate;
+	const float step = (increment - mIncrement) / nFrames;
+
+	if (waveform == Oscillator::Waveform::kNoise || waveform == Oscillator::Waveform::kRandom) {
+		mNoise.ProcessSamples(left, nFrames, freq_hz, pw);
+		for (int i = 0; i < nFrames; i++)
+			right[i] = left[i] = left[i] * 0.5f;
+		mIncrement = increment;
+		return;
+	}
+
+	std::fill(left, left + nFrames, 0.f);
+	std::fill(right, right + nFrames, 0.f);
+
+	for (int k = 0; k < mVoices; k++) {
+		const float phase = mPhase[k];
+		const float ratio = mRatio[k];
+		const float gainL = mGainL[k];
+		const float gainR = mGainR[k];
+
+		switch (waveform) {
+		case Oscillator::Waveform::kSine:
+			mPhase[k] = renderUnisonCopy([](float t, float) {
+				return sinf(m::twoPi * t);
+			}, left, right, nFrames, phase, ratio, mIncrement, step, gainL, gainR);
+			break;
+
+		case Oscillator::Waveform::kPulse: {
+			// same crossing point interpolation as Oscillator::doSquare
+			const float radsper = m::twoPi * increment * ratio;
+			const float pwscale = radsper < 0.3f ? 1.0f : 1.0f - ((radsper - 0.3f) / 2);
+			const float pwt = 0.5f + 0.5f * pwscale * std::min(pw, 0.9f);
+			mPhase[k] = renderUnisonCopy([pwt](float t, float dt) {
+				return t < dt ? 2.f * (t / dt) - 1.f :
+					t <= pwt ? 1.f :
+					t - dt <= pwt ? 1.f - 2.f * (t - pwt) / dt :
+					-1.f;
+			}, left, right, nFrames, phase, ratio, mIncrement, step, gainL, gainR);
+			break;
+		}
+
+		case Oscillator::Waveform::kSaw: {
+			// same slope limit as Oscillator::doSaw
+			const float shape = std::min(pw, pw - 2.0f * increment * ratio);
+			const float a = (shape + 1.0f) / 2.0f;
+			mPhase[k] = renderUnisonCopy([a](float t, float) {
+				return t < a / 2 ? 2 * t / a :
+					t > 1 - a / 2 ? (2 * t - 2) / a :
+					(1 - 2 * t) / (1 - a);
+			}, left, right, nFrames, phase, ratio, mIncrement, step, gainL, gainR);
+			break;
+		}
+
+		default:
+			break;
+		}
+	}
+
+	mIncrement = increment;
+}
@@ -76,4 +76,46 @@ private:
 	void doRandom(float*, int nFrames);
 };
 
+/**
+ * @brief A bank of detuned copies of one oscillator, for unison / supersaw.
+ *
+ * Copies are stored as arrays of phases and increments, and each sample is
+ * computed for all copies at once in a branch-free loop the compiler can
+ * vectorise. Output is accumulated into separate left and right mixes
+ * according to each copy's position in the stereo spread.
+ */
+class UnisonOscillator
+{
+public:
+	static constexpr int kMaxVoices = 8;
+
+	UnisonOscillator() { reset(); }
+
+	void	SetSampleRate	(int rateIn);
+	void	SetWaveform		(Oscillator::Waveform);
+
+	// detune is the maximum offset of the outer copies in units of 50 cents,
+	// spread the width of the stereo image from 0 (mono) to 1 (hard left/right)
+	void	setVoices		(int voices, float detune, float spread);
+	int		getVoices		() const { return mVoices; }
+
+	void	reset			();
+
+	// Overwrites left and right. Noise waveforms are rendered as a single centred copy.
+	void	ProcessSamples	(float *left, float *right, int nFrames, float freq_hz, float pw);
+
+private:
+	int		rate = 44100;
+	int		mVoices = 1;
+	float	mGain = 1;
+	float	mIncrement = 0;
+	Oscillator::Waveform waveform = Oscillator::Waveform::kSine;
+	Oscillator mNoise;
+
+	float	mPhase[kMaxVoices] {};
+	float	mRatio[kMaxVoices] {};
+	float	mGainL[kMaxVoices] {};
+	float	mGainR[kMaxVoices] {};
+};
+
 #endif				/// _OSCILLATOR_H
@@ -0,0 +1,168 @@
+/*
+ *  Oversampler.cpp
+ *
+ *  Copyright (c) 2023 Nick Dowell
+ *
+ *  This file is part of amsynth.
+ *
+ *  amsynth is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  amsynth is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with amsynth.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Oversampler.h"
+
+#include "Synth--.h"
+
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+HalfBandFilter::HalfBandFilter()
+{
+	// Blackman windowed sinc with its cutoff at a quarter of the sample rate.
+	// The full filter has 2 * kTaps - 1 taps with the centre (0.5) at kTaps - 1;
+	// the taps stored here are those an even distance from the start, reversed
+	// so that the convolution below reads the history forwards.
+	const int length = 2 * kTaps - 1;
+	const int centre = kTaps - 1;
+	double sum = 0;
+	for (int j = 0; j < kTaps; j++) {
+		const int n = 2 * j;
+		const double x = (n - centre) * m::pi / 2;
+		const double window = 0.42 - 0.5 * cos(2 * m::pi * n / (length - 1)) + 0.08 * cos(4 * m::pi * n / (length - 1));
+		const double h = 0.5 * sin(x) / x * window;
+		mCoefs[kTaps - 1 - j] = (float) h;
+		sum += h;
+	}
+	// normalise for unity gain at DC
+	for (int j = 0; j < kTaps; j++)
+		mCoefs[j] = (float) (mCoefs[j] * 0.5 / sum);
+	reset();
+}
+
+void
+HalfBandFilter::reset()
+{
+	memset(mEven, 0, sizeof(mEven));
+	memset(mOdd, 0, sizeof(mOdd));
+}
+
+void
+HalfBandFilter::upsample(const float *in, float *out, int nFrames)
+{
+	assert(nFrames <= kMaxFrames);
+
+	float *history = mEven;
+	memcpy(history + kTaps - 1, in, nFrames * sizeof(float));
+
+	for (int i = 0; i < nFrames; i++) {
+		float y = 0;
+		for (int j = 0; j < kTaps; j++)
+			y += mCoefs[j] * history[i + j];
+		// the zero-stuffed input halves the level, so both phases are doubled
+		out[2 * i] = 2.f * y;
+		out[2 * i + 1] = history[i + kTaps / 2];
+	}
+
+	memmove(history, history + nFrames, (kTaps - 1) * sizeof(float));
+}
+
+void
+HalfBandFilter::downsample(const float *in, float *out, int nFrames)
+{
+	assert(nFrames <= kMaxFrames);
+
+	for (int i = 0; i < nFrames; i++) {
+		mEven[kTaps - 1 + i] = in[2 * i];
+		mOdd[kTaps / 2 + i] = in[2 * i + 1];
+	}
+
+	for (int i = 0; i < nFrames; i++) {
+		float y = 0;
+		for (int j = 0; j < kTaps; j++)
+			y += mCoefs[j] * mEven[i + j];
+		out[i] = y + 0.5f * mOdd[i];
+	}
+
+	memmove(mEven, mEven + nFrames, (kTaps - 1) * sizeof(float));
+	memmove(mOdd, mOdd + nFrames, (kTaps / 2) * sizeof(float));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void
+Oversampler::setFactor(int factor)
+{
+	mFactor = factor >= 4 ? 4 : factor >= 2 ? 2 : 1;
+	reset();
+}
+
+float
+Oversampler::getLatency() const
+{
+	// Each linear phase half-band stage delays by kTaps - 1 samples at its
+	// higher rate
+	float latency = 0;
+	for (int factor = 2; factor <= mFactor; factor *= 2)
+		latency += (HalfBandFilter::kTaps - 1) / (float) factor;
+	return latency;
+}
+
+void
+Oversampler::reset()
+{
+	for (int i = 0; i < 2; i++) {
+		mUp[i].reset();
+		mDown[i].reset();
+	}
+}
+
+void
+Oversampler::upsample(const float *in, float *out, int nFrames)
+{
+	assert(nFrames <= kMaxFrames);
+
+	switch (mFactor) {
+	case 1:
+		if (out != in)
+			memcpy(out, in, nFrames * sizeof(float));
+		break;
+	case 2:
+		mUp[0].upsample(in, out, nFrames);
+		break;
+	case 4:
+		mUp[0].upsample(in, mScratch, nFrames);
+		mUp[1].upsample(mScratch, out, nFrames * 2);
+		break;
+	}
+}
+
+void
+Oversampler::downsample(const float *in, float *out, int nFrames)
+{
+	assert(nFrames <= kMaxFrames);
+
+	switch (mFactor) {
+	case 1:
+		if (out != in)
+			memcpy(out, in, nFrames * sizeof(float));
+		break;
+	case 2:
+		mDown[0].downsample(in, out, nFrames);
+		break;
+	case 4:
+		mDown[1].downsample(in, mScratch, nFrames * 2);
+		mDown[0].downsample(mScratch, out, nFrames);
+		break;
+	}
+}
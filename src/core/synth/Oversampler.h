@@ -0,0 +1,91 @@
+/*
+ *  Oversampler.h
+ *
+ *  Copyright (c) 2023 Nick Dowell
+ *
+ *  This file is part of amsynth.
+ *
+ *  amsynth is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  amsynth is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with amsynth.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _OVERSAMPLER_H
+#define _OVERSAMPLER_H
+
+/**
+ * @brief A polyphase half-band FIR filter that doubles or halves the sample rate.
+ *
+ * Every other tap of a half-band filter is zero apart from the centre tap, so
+ * only the non-zero taps are stored and each phase is computed separately.
+ * An instance keeps history for one direction only; use separate instances
+ * for upsampling and downsampling.
+ */
+class HalfBandFilter
+{
+public:
+	// number of non-zero taps either side of the centre tap, combined
+	static constexpr int kTaps = 24;
+	// maximum number of frames per call, at the lower rate
+	static constexpr int kMaxFrames = 128;
+
+	HalfBandFilter();
+
+	void	reset		();
+
+	// reads nFrames, writes 2 * nFrames
+	void	upsample	(const float *in, float *out, int nFrames);
+	// reads 2 * nFrames, writes nFrames; in and out may be the same buffer
+	void	downsample	(const float *in, float *out, int nFrames);
+
+private:
+	float	mCoefs[kTaps];
+	float	mEven[kTaps - 1 + kMaxFrames];
+	float	mOdd[kTaps / 2 + kMaxFrames];
+};
+
+/**
+ * @brief Runs part of the signal chain at 2x or 4x the sample rate.
+ *
+ * Factors above 2 cascade half-band stages. Stages that generate aliasing
+ * either render at the higher rate directly and only call downsample(), or
+ * wrap their processing in upsample() and downsample().
+ */
+class Oversampler
+{
+public:
+	static constexpr int kMaxFactor = 4;
+	// maximum number of frames per call, at the base rate
+	static constexpr int kMaxFrames = 64;
+
+	// 1, 2 or 4; anything else is rounded down
+	void	setFactor	(int factor);
+	int		getFactor	() const { return mFactor; }
+
+	// Delay added by upsample() or by downsample(), in base rate samples
+	float	getLatency	() const;
+
+	void	reset		();
+
+	// reads nFrames, writes nFrames * factor
+	void	upsample	(const float *in, float *out, int nFrames);
+	// reads nFrames * factor, writes nFrames; in and out may be the same buffer
+	void	downsample	(const float *in, float *out, int nFrames);
+
+private:
+	int		mFactor = 1;
+	HalfBandFilter	mUp[2];
+	HalfBandFilter	mDown[2];
+	float	mScratch[kMaxFrames * 2];
+};
+
+#endif
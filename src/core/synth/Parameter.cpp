@@ -30,7 +30,9 @@
 
 #define _(string) gettext (string)
 
+#include <algorithm>
 #include <cassert>
+#include <cstdint>
 #include <sstream>
 #include <cstring>
 #include <vector>
@@ -76,13 +78,18 @@ static const ParameterSpec ParameterSpecs[] = { //                            de
 	SPEC(kAmsynthParameter_PortamentoTime,          "portamento_time",       0.0f,   0.0f,   1.0f,  0.0f,       kParameterLaw_Linear,        1.0f,  0.0f,       ""   ),
 	SPEC(kAmsynthParameter_KeyboardMode,            "keyboard_mode",         0.0f,   0.0f,   2.0f,  1.0f,       kParameterLaw_Linear,        1.0f,  0.0f,       ""   ),
 	SPEC(kAmsynthParameter_Oscillator2Pitch,        "osc2_pitch",            0.0f, -12.0f,  12.0f,  1.0f,       kParameterLaw_Linear,        1.0f,  0.0f,       ""   ),
-	SPEC(kAmsynthParameter_FilterType,              "filter_type",           0.0f,   0.0f,   4.0f,  1.0f,       kParameterLaw_Linear,        1.0f,  0.0f,       ""   ),
+	SPEC(kAmsynthParameter_FilterType,              "filter_type",           0.0f,   0.0f,   8.0f,  1.0f,       kParameterLaw_Linear,        1.0f,  0.0f,       ""   ),
 	SPEC(kAmsynthParameter_FilterSlope,             "filter_slope",          1.0f,   0.0f,   1.0f,  1.0f,       kParameterLaw_Linear,        1.0f,  0.0f,       ""   ),
 	SPEC(kAmsynthParameter_LFOOscillatorSelect,     "freq_mod_osc",          0.0f,   0.0f,   2.0f,  1.0f,       kParameterLaw_Linear,        1.0f,  0.0f,       ""   ),
 	SPEC(kAmsynthParameter_FilterKeyTrackAmount,    "filter_kbd_track",      1.0f,   0.0f,   1.0f,  0.0f,       kParameterLaw_Linear,        1.0f,  0.0f,       ""   ),
 	SPEC(kAmsynthParameter_FilterKeyVelocityAmount, "filter_vel_sens",       1.0f,   0.0f,   1.0f,  0.0f,       kParameterLaw_Linear,        1.0f,  0.0f,       ""   ),
 	SPEC(kAmsynthParameter_AmpVelocityAmount,       "amp_vel_sens",          1.0f,   0.0f,   1.0f,  0.0f,       kParameterLaw_Linear,        1.0f,  0.0f,       ""   ),
 	SPEC(kAmsynthParameter_PortamentoMode,          "portamento_mode",       0.0f,   0.0f,   1.0f,  1.0f,       kParameterLaw_Linear,        1.0f,  0.0f,       ""   ),
+	SPEC(kAmsynthParameter_UnisonVoices,            "unison_voices",         1.0f,   1.0f,   8.0f,  1.0f,       kParameterLaw_Linear,        1.0f,  0.0f,       ""   ),
+	SPEC(kAmsynthParameter_UnisonDetune,            "unison_detune",         0.0f,   0.0f,   1.0f,  0.0f,       kParameterLaw_Linear,        1.0f,  0.0f,       ""   ),
+	SPEC(kAmsynthParameter_UnisonSpread,            "unison_spread",         0.0f,   0.0f,   1.0f,  0.0f,       kParameterLaw_Linear,        1.0f,  0.0f,       ""   ),
+	SPEC(kAmsynthParameter_VoicePanSpread,          "voice_pan_spread",      0.0f,   0.0f,   1.0f,  0.0f,       kParameterLaw_Linear,        1.0f,  0.0f,       ""   ),
+	SPEC(kAmsynthParameter_VoicePanMode,            "voice_pan_mode",        0.0f,   0.0f,   2.0f,  1.0f,       kParameterLaw_Linear,        1.0f,  0.0f,       ""   ),
 };
 
 static float getControlValue(const ParameterSpec &spec, float value)
@@ -151,6 +158,91 @@ Parameter::valueFromString(const std::string &str)
 	return value;
 }
 
+const char *
+Parameter::parseValue(const char *begin, const char *end, float &value)
+{
+	static const double powersOfTen[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+
+	const char *p = begin;
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+		negative = *p++ == '-';
+
+	// Up to 19 significant digits fit in the mantissa, the rest only scale it
+	uint64_t mantissa = 0;
+	int digits = 0, exponent = 0;
+	bool seenDigit = false;
+
+	// Plain decimals are also accumulated in float, digit by digit, exactly
+	// as earlier versions read bank files. This is not correctly rounded, but
+	// it keeps every stored value, and so every existing sound, unchanged.
+	float accumulated = 0, scale = 1;
+
+	for (; p < end && *p >= '0' && *p <= '9'; p++) {
+		seenDigit = true;
+		accumulated = accumulated * 10.0f + (float) (*p - '0');
+		if (digits < 19) {
+			mantissa = mantissa * 10 + (*p - '0');
+			digits += mantissa ? 1 : 0;
+		} else {
+			exponent++;
+		}
+	}
+	if (p < end && *p == '.') {
+		for (p++; p < end && *p >= '0' && *p <= '9'; p++) {
+			seenDigit = true;
+			scale /= 10.0f;
+			accumulated = accumulated * 10.0f + (float) (*p - '0');
+			if (digits < 19) {
+				mantissa = mantissa * 10 + (*p - '0');
+				digits += mantissa ? 1 : 0;
+				exponent--;
+			}
+		}
+	}
+	if (!seenDigit)
+		return nullptr;
+
+	bool hasExponent = false;
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		const char *q = p + 1;
+		bool negativeExponent = false;
+		if (q < end && (*q == '-' || *q == '+'))
+			negativeExponent = *q++ == '-';
+		int e = 0;
+		const char *digitsBegin = q;
+		for (; q < end && *q >= '0' && *q <= '9'; q++)
+			e = std::min(e * 10 + (*q - '0'), 9999);
+		if (q != digitsBegin) {
+			exponent += negativeExponent ? -e : e;
+			hasExponent = true;
+			p = q;
+		}
+	}
+
+	if (!hasExponent) {
+		value = accumulated * (negative ? -scale : scale);
+		return p;
+	}
+
+	// Values with an exponent were read with a C++ stream, which rounds
+	// correctly
+	double result = (double) mantissa;
+	if (mantissa == 0)
+		result = 0;
+	else if (mantissa < (1ull << 53) && exponent >= -22 && exponent <= 22)
+		// both operands are exact, so the result is correctly rounded
+		result = exponent < 0 ? result / powersOfTen[-exponent] : result * powersOfTen[exponent];
+	else
+		result = result * pow(10.0, exponent);
+
+	value = (float) (negative ? -result : result);
+	return p;
+}
+
 const std::string
 Parameter::getStringValue() const
 {
@@ -191,14 +283,49 @@ const char *parameter_name_from_index(int param_index)
 	return ParameterSpecs[param_index].name;
 }
 
-int parameter_index_from_name(const char *name)
-{
-	for (int i = 0; i < kAmsynthParameterCount; i++) {
-		if (!strcmp(ParameterSpecs[i].name, name)) {
-			return i;
+// Parameter names are looked up for every line of a bank file, so use a perfect
+// hash: the seed is chosen on first use such that no two names share a slot.
+struct ParameterNameTable {
+	static constexpr unsigned kSize = 256;
+
+	uint32_t seed = 0;
+	signed char slots[kSize];
+
+	ParameterNameTable() {
+		for (;; seed++) {
+			memset(slots, -1, sizeof(slots));
+			int i;
+			for (i = 0; i < kAmsynthParameterCount; i++) {
+				unsigned slot = hash(ParameterSpecs[i].name, strlen(ParameterSpecs[i].name));
+				if (slots[slot] != -1)
+					break;
+				slots[slot] = (signed char) i;
+			}
+			if (i == kAmsynthParameterCount)
+				return;
 		}
 	}
-	return -1;
+
+	unsigned hash(const char *name, size_t length) const {
+		uint32_t h = 2166136261u ^ seed; // FNV-1a
+		for (size_t i = 0; i < length; i++)
+			h = (h ^ (unsigned char) name[i]) * 16777619u;
+		return (h ^ (h >> 16)) & (kSize - 1);
+	}
+};
+
+int parameter_index_from_name_len(const char *name, size_t length)
+{
+	static const ParameterNameTable table;
+	int index = table.slots[table.hash(name, length)];
+	if (index < 0 || strlen(ParameterSpecs[index].name) != length || memcmp(ParameterSpecs[index].name, name, length))
+		return -1;
+	return index;
+}
+
+int parameter_index_from_name(const char *name)
+{
+	return parameter_index_from_name_len(name, strlen(name));
 }
 
 int parameter_get_display(int param_index, float value, char *buffer, size_t maxlen)
@@ -249,7 +376,13 @@ int parameter_get_display(int param_index, float value, char *buffer, size_t max
 		case kAmsynthParameter_FilterKeyTrackAmount:
 		case kAmsynthParameter_FilterKeyVelocityAmount:
 		case kAmsynthParameter_AmpVelocityAmount:
+		case kAmsynthParameter_UnisonSpread:
+		case kAmsynthParameter_VoicePanSpread:
 			return snprintf(buffer, maxlen, "%d %%", (int)roundf(normalised * 100.f));
+		case kAmsynthParameter_UnisonVoices:
+			return snprintf(buffer, maxlen, "%d", (int)cv);
+		case kAmsynthParameter_UnisonDetune:
+			return snprintf(buffer, maxlen, "%.1f Cents", cv * 50.f);
 		case kAmsynthParameter_FilterType: {
 			const char **filter_type_names = parameter_get_value_strings(param_index);
 			return filter_type_names ? snprintf(buffer, maxlen, "%s", filter_type_names[(int)cv]) : 0;
@@ -265,6 +398,7 @@ int parameter_get_display(int param_index, float value, char *buffer, size_t max
 		case kAmsynthParameter_FilterSlope:
 		case kAmsynthParameter_LFOOscillatorSelect:
 		case kAmsynthParameter_PortamentoMode:
+		case kAmsynthParameter_VoicePanMode:
 			return 0;
 		case kAmsynthParameterCount:
 		default:
@@ -315,12 +449,16 @@ const char **parameter_get_value_strings(int param_index)
 				break;
 
 			case kAmsynthParameter_FilterType:
-				strings.resize(size = 6);
+				strings.resize(size = 10);
 				strings[i++] = _("low pass");
 				strings[i++] = _("high pass");
 				strings[i++] = _("band pass");
 				strings[i++] = _("notch");
 				strings[i++] = _("bypass");
+				strings[i++] = _("low pass (SVF)");
+				strings[i++] = _("high pass (SVF)");
+				strings[i++] = _("band pass (SVF)");
+				strings[i++] = _("notch (SVF)");
 				assert(i < size);
 				break;
 
@@ -346,6 +484,14 @@ const char **parameter_get_value_strings(int param_index)
 				assert(i < size);
 				break;
 
+			case kAmsynthParameter_VoicePanMode:
+				strings.resize(size = 4);
+				strings[i++] = _("key");
+				strings[i++] = _("velocity");
+				strings[i++] = _("random");
+				assert(i < size);
+				break;
+
 			default:
 				break;
 		}
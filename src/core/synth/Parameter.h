@@ -75,6 +75,10 @@ public:
 
 	static float	valueFromString	(const std::string &str);
 
+	// Locale-independent number parser that does not allocate. Parses as much of
+	// [begin, end) as forms a number and returns a pointer past it, or nullptr.
+	static const char * parseValue	(const char *begin, const char *end, float &value);
+
 	float			getNormalisedValue	() const { return (getValue()-getMin())/(getMax()-getMin()); }
 	void			setNormalisedValue	(float val) { setValue (val*(getMax()-getMin())+getMin()); }
 
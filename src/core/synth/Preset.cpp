@@ -31,7 +31,6 @@
 #include <cstdio>
 #include <cstdlib>
 #include <iterator>
-#include <map>
 #include <vector>
 
 
@@ -72,16 +71,9 @@ Preset::isEqual(const Preset &rhs)
 Parameter & 
 Preset::getParameter(const std::string name)
 {
-	typedef std::map<std::string, int> name_map_t;
-	static name_map_t name_map;
-	if (name_map.empty()) {
-		for (int i = 0; i < kAmsynthParameterCount; i++) {
-			name_map[getParameter(i).getName()] = i;
-		}
-	}
-	name_map_t::iterator it = name_map.find(name);
-	assert(it != name_map.end());
-	return getParameter((int) it->second);
+	int index = parameter_index_from_name_len(name.data(), name.size());
+	assert(index != -1);
+	return getParameter(index);
 }
 
 void
@@ -24,6 +24,7 @@
 
 #include "Parameter.h"
 
+#include <algorithm>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -40,7 +41,12 @@ public:
 	bool			isEqual			(const Preset &);
 
 	const std::string& getName		() const { return mName; }
-	void			setName			(const std::string name) { mName = name; }
+	void			setName			(const std::string &name) { mName = name; }
+
+	// Copies the name without allocating, truncating it to the reserved capacity
+	// if necessary. Used when selecting presets on the audio thread.
+	void			reserveName		(size_t capacity) { mName.reserve(capacity); }
+	void			assignName		(const std::string &name) { mName.assign(name, 0, std::min(name.size(), mName.capacity())); }
 	
 	Parameter&		getParameter	(const std::string name);
 	Parameter&		getParameter	(const int no) { return mParameters.at(no); };
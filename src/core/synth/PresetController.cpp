@@ -25,31 +25,87 @@
 
 #include "PresetController.h"
 
+#include "core/FileWatcher.h"
 #include "core/filesystem.h"
 #include "core/gettext.h"
 
 #include <algorithm>
+#include <cerrno>
+#include <condition_variable>
 #include <iostream>
-#include <cassert>
 #include <cstdlib>
 #include <cstring>
 #include <string>
 #include <fstream>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <thread>
 #include <sys/types.h>
 #include <sys/stat.h>
 
 #ifdef _WIN32
 #include <Windows.h>
+#include <io.h>
 #else
 #include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #endif
 
 #define _(string) gettext (string)
 
+static std::shared_ptr<const PresetBank> loadSharedBank(const std::string &file_path);
+static void publishSharedBank(const std::string &file_path, const std::shared_ptr<const PresetBank> &bank);
+static void retainBankWatcher();
+static uint64_t queueBankWrite(const std::string &file_path, const std::shared_ptr<const PresetBank> &bank);
+static bool waitForBankWrite(uint64_t request);
+static void releaseBankWatcher();
+
+// s_banks is only modified by scan_preset_banks, and read on the audio thread by
+// selectBank, which uses try_lock so it never blocks.
+static std::mutex s_banksMutex;
+static std::vector<BankInfo> s_banks;
+static bool s_banksScanned;
+
+// Every live PresetController, so that banks retired on the audio thread can
+// be released from whichever thread notices a change. Holding the mutex also
+// makes releasing the single consumer of each controller's retired banks.
+static std::mutex s_controllersMutex;
+static std::set<PresetController *> s_controllers;
+
+static const std::shared_ptr<const PresetBank> & blankBank()
+{
+	static const std::shared_ptr<const PresetBank> bank = [] {
+		auto bank = std::make_shared<PresetBank>();
+		bank->updateValues();
+		return bank;
+	}();
+	return bank;
+}
+
+void
+PresetBank::updateValues()
+{
+	for (int i = 0; i < PresetController::kNumPresets; i++)
+		for (int p = 0; p < kAmsynthParameterCount; p++)
+			values[i][p] = presets[i].getParameter(p).getValue();
+}
+
 
 PresetController::PresetController()
+: presets(blankBank())
 {
+	retainBankWatcher();
+
+	// Reserve enough space that selecting presets & banks on the audio thread
+	// does not need to allocate
+	currentPreset.reserveName(256);
+	realtimeBankFile.reserve(1024);
+	publishBank();
+
 	// Load the first user-writable bank by default, falling back to first read-only one.
 	const auto &banks = getPresetBanks();
 	if (!banks.empty()) {
@@ -60,7 +116,48 @@ PresetController::PresetController()
 		selectPreset(0);
 	}
 
+	currentPreset.reserveName(256);
+
 	currentPreset.addObserver(this);
+
+	std::lock_guard<std::mutex> lock(s_controllersMutex);
+	s_controllers.insert(this);
+}
+
+PresetController::~PresetController()
+{
+	{
+		std::lock_guard<std::mutex> lock(s_controllersMutex);
+		s_controllers.erase(this);
+	}
+	clearChangeBuffers();
+	releaseBankWatcher();
+}
+
+// Called with s_controllersMutex held
+void
+PresetController::drainRetiredBanks()
+{
+	unsigned read = retiredBanksRead.load(std::memory_order_relaxed);
+	const unsigned write = retiredBanksWrite.load(std::memory_order_acquire);
+	for (; read != write; read++)
+		retiredBanks[read % kMaxRetiredBanks].reset();
+	retiredBanksRead.store(read, std::memory_order_release);
+}
+
+void
+PresetController::releaseRetiredPresets()
+{
+	std::lock_guard<std::mutex> lock(s_controllersMutex);
+	drainRetiredBanks();
+}
+
+void
+PresetController::releaseRetiredBanks()
+{
+	std::lock_guard<std::mutex> lock(s_controllersMutex);
+	for (PresetController *controller : s_controllers)
+		controller->drainRetiredBanks();
 }
 
 int
@@ -69,11 +166,77 @@ PresetController::selectPreset		(const int presetNo)
 	if (presetNo > (kNumPresets - 1) || presetNo < 0)
 		return -1;
 	currentPreset = getPreset(currentPresetNo = presetNo);
+	captureSelectedPreset(*presets);
+	selectedNameModified = false;
+	releaseRetiredPresets();
 	notify();
 	clearChangeBuffers ();
+	changeBuffersInvalid = false;
+	return 0;
+}
+
+int
+PresetController::selectPresetRealtime	(const int presetNo)
+{
+	if (presetNo > (kNumPresets - 1) || presetNo < 0)
+		return -1;
+	std::unique_lock<std::mutex> lock(realtimeMutex, std::try_to_lock);
+	if (!lock.owns_lock())
+		return -1;
+	const PresetBank &bank = *realtimePresets;
+	const float *values = bank.values[presetNo];
+	for (int i = 0; i < kAmsynthParameterCount; i++)
+		if (!Preset::shouldIgnoreParameter(i))
+			currentPreset.getParameter(i).setValue(values[i]);
+	currentPreset.assignName(bank[presetNo].getName());
+	currentPresetNo = presetNo;
+	captureSelectedPreset(bank);
+	selectedNameModified = false;
+	changeBuffersInvalid = true;
 	return 0;
 }
 
+void
+PresetController::captureSelectedPreset(const PresetBank &bank)
+{
+	const int presetNo = currentPresetNo;
+	if (presetNo == -1)
+		return;
+	const float *values = bank.values[presetNo];
+	for (int i = 0; i < kAmsynthParameterCount; i++)
+		selectedValues[i].store(values[i], std::memory_order_relaxed);
+}
+
+bool
+PresetController::isCurrentPresetModifiedRealtime() const
+{
+	if (currentPresetNo == -1)
+		return false;
+	if (selectedNameModified.load(std::memory_order_relaxed))
+		return true;
+	for (int i = 0; i < kAmsynthParameterCount; i++)
+		if (!Preset::shouldIgnoreParameter(i) &&
+			currentPreset.getParameter(i).getValue() != selectedValues[i].load(std::memory_order_relaxed))
+			return true;
+	return false;
+}
+
+void
+PresetController::setCurrentPresetName(const std::string &name)
+{
+	currentPreset.setName(name);
+	selectedNameModified = currentPresetNo != -1 && name != getPreset(currentPresetNo).getName();
+}
+
+void
+PresetController::setCurrPresetNumber(int num)
+{
+	adoptRealtimeBank();
+	currentPresetNo = num;
+	captureSelectedPreset(*presets);
+	selectedNameModified = num != -1 && currentPreset.getName() != getPreset(num).getName();
+}
+
 bool
 PresetController::containsPresetWithName(const std::string name)
 {
@@ -83,12 +246,70 @@ PresetController::containsPresetWithName(const std::string name)
 	return false;
 }
 
+const Preset &
+PresetController::getPreset		(int preset)
+{
+	adoptRealtimeBank();
+	return (*presets)[preset];
+}
+
+bool
+PresetController::isCurrentPresetModified()
+{
+	adoptRealtimeBank();
+	return currentPresetNo != -1 && !currentPreset.isEqual((*presets)[currentPresetNo]);
+}
+
+void
+PresetController::publishBank()
+{
+	std::shared_ptr<const PresetBank> previous = presets;
+	{
+		std::lock_guard<std::mutex> lock(realtimeMutex);
+		std::swap(realtimePresets, previous);
+		realtimeBankNo = currentBankNo;
+		realtimeBankSelected = false;
+	}
+	// previous is released here, off the audio thread and outside the lock
+}
+
+void
+PresetController::adoptRealtimeBank()
+{
+	std::shared_ptr<const PresetBank> previous;
+	{
+		std::lock_guard<std::mutex> lock(realtimeMutex);
+		if (!realtimeBankSelected)
+			return;
+		realtimeBankSelected = false;
+		previous = std::move(presets);
+		presets = realtimePresets;
+		currentBankNo = realtimeBankNo;
+		bank_file.assign(realtimeBankFile);
+	}
+}
+
+void
+PresetController::commitPreset		()
+{
+	adoptRealtimeBank();
+	auto bank = std::make_shared<PresetBank>(*presets);
+	(*bank)[currentPresetNo] = currentPreset;
+	bank->updateValues();
+	presets = bank;
+	publishBank();
+	captureSelectedPreset(*presets);
+	selectedNameModified = false;
+	releaseRetiredPresets();
+	notify();
+}
+
 void
 PresetController::saveCurrentPreset	()
 {
-	loadPresets(); // in case another instance has changed any of the other presets
+	loadPresets(); // in case another instance has changed any of the other presets - only reads the file if it was modified
 	commitPreset();
-	savePresets();
+	saveInBackground();
 }
 
 void
@@ -97,13 +318,15 @@ PresetController::clearPreset		()
 	loadPresets();
 	currentPreset = blankPreset;
 	commitPreset();
-	savePresets();
+	saveInBackground();
 	clearChangeBuffers();
+	changeBuffersInvalid = false;
 }
 
 void
 PresetController::parameterWillChange(const Parameter &parameter)
 {
+	clearInvalidChangeBuffers();
 	undoBuffer.push(new ParamChange(parameter.getId(), parameter.getValue()));
 	clearRedoBuffer();
 }
@@ -111,6 +334,7 @@ PresetController::parameterWillChange(const Parameter &parameter)
 void
 PresetController::undoChange	()
 {
+	clearInvalidChangeBuffers();
 	if(!undoBuffer.empty())
 	{
 		undoBuffer.top()->initiateUndo(this);
@@ -122,6 +346,7 @@ PresetController::undoChange	()
 void
 PresetController::redoChange	()
 {
+	clearInvalidChangeBuffers();
 	if(!redoBuffer.empty())
 	{
 		redoBuffer.top()->initiateRedo(this);
@@ -161,6 +386,7 @@ PresetController::redoChange	( RandomiseChange *change )
 void
 PresetController::randomiseCurrentPreset	()
 {
+	clearInvalidChangeBuffers();
 	undoBuffer.push(new RandomiseChange(currentPreset));
 	clearRedoBuffer();
 	currentPreset.randomise();
@@ -190,9 +416,10 @@ PresetController::importPreset		(const std::string filename)
 		std::ifstream ifs( filename.c_str(), std::ios::in );
 		std::string str( (std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>() );
 		if (!currentPreset.fromString( str )) return -1;
-		currentPreset.setName("Imported: " + currentPreset.getName());
+		setCurrentPresetName("Imported: " + currentPreset.getName());
 		notify ();
 		clearChangeBuffers ();
+		changeBuffersInvalid = false;
 		return 0;
 	}
 	catch (std::exception &e)
@@ -201,42 +428,45 @@ PresetController::importPreset		(const std::string filename)
 	}
 }
 
-static long int mtime(const char *filename)
+// Identifies a version of a file's contents
+struct FileStamp {
+	time_t mtime;
+	long mtime_nsec;
+	off_t size;
+
+	bool operator==(const FileStamp &other) const {
+		return mtime == other.mtime && mtime_nsec == other.mtime_nsec && size == other.size;
+	}
+};
+
+static FileStamp file_stamp(const char *filename)
 {
 	struct stat st;
 	if (stat(filename, &st) != 0) {
-		return 0;
+		return FileStamp{0, 0, 0};
 	}
-	return st.st_mtime;
+#ifdef __linux__
+	return FileStamp{st.st_mtime, st.st_mtim.tv_nsec, st.st_size};
+#else
+	return FileStamp{st.st_mtime, 0, st.st_size};
+#endif
 }
 
 int 
 PresetController::savePresets		(const char *filename)
 {
-	if (filename == nullptr)
-		filename = bank_file.c_str();
-
-	std::ofstream file( filename, std::ios::out );
-  
-	file << "amSynth\n";
-	for (int i = 0; i < kNumPresets; i++) {
-		if (presets[i].getName()!="unused"){
-			file << "<preset> " << "<name> " << presets[i].getName() << "\n";
-			for (int n = 0; n < kAmsynthParameterCount; n++)
-			{
-				file << "<parameter> " 
-				<< presets[i].getParameter(n).getName()
-				<< " " << presets[i].getParameter(n).getValue() << "\n";
-			}
-		}
-	}
-	file << "EOF" << std::endl;
-	file.close();
-
-	lastPresetsFileModifiedTime = mtime(filename);
-	bank_file = std::string(filename);
+	adoptRealtimeBank();
+	if (filename)
+		bank_file.assign(filename);
+	return waitForBankWrite(saveInBackground()) ? 0 : -1;
+}
 
-	return 0;
+uint64_t
+PresetController::saveInBackground	()
+{
+	// Other instances see the new bank straight away, before it is written
+	publishSharedBank(bank_file, presets);
+	return queueBankWrite(bank_file, presets);
 }
 
 BankInfo::~BankInfo() {}
@@ -262,118 +492,182 @@ static bool is_amsynth_file(const char *filename)
 	return true;
 }
 
-static off_t file_read_contents(const char *filename, void **result)
+// Read-only view of a file's contents. Memory mapped where possible, so bank
+// files are parsed in place without copying.
+class MappedFile {
+public:
+	explicit MappedFile(const char *filename);
+	~MappedFile();
+	MappedFile(const MappedFile &) = delete;
+	MappedFile & operator=(const MappedFile &) = delete;
+
+	const char * data() const { return data_; }
+	size_t size() const { return size_; }
+
+private:
+	const char *data_ = nullptr;
+	size_t size_ = 0;
+	bool mapped_ = false;
+};
+
+MappedFile::MappedFile(const char *filename)
 {
-	*result = nullptr;
-	FILE *file = fopen(filename, "r");
+#ifndef _WIN32
+	int fd = open(filename, O_RDONLY);
+	if (fd == -1)
+		return;
+	struct stat st;
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		void *addr = mmap(nullptr, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (addr != MAP_FAILED) {
+			data_ = (const char *) addr;
+			size_ = (size_t) st.st_size;
+			mapped_ = true;
+		}
+	}
+	close(fd);
+	if (mapped_)
+		return;
+#endif
+	FILE *file = fopen(filename, "rb");
 	if (!file)
-		return 0;
+		return;
 	fseek(file, 0, SEEK_END);
-	off_t length = ftell(file);
-	void *buffer = calloc(length + 1, 1);
-	if (!buffer) {
-		fprintf(stderr, "Error reading %s\n", filename);
-		fclose(file);
-		return 0;
-	}
+	long length = ftell(file);
 	fseek(file, 0, SEEK_SET);
-	length = fread(buffer, 1, length, file);
-	if (!length) {
-		fprintf(stderr, "Error reading %s\n", filename);
-		fclose(file);
+	char *buffer = length > 0 ? (char *) malloc(length) : nullptr;
+	if (buffer && fread(buffer, 1, length, file) == (size_t) length) {
+		data_ = buffer;
+		size_ = (size_t) length;
+	} else {
 		free(buffer);
-		return 0;
 	}
 	fclose(file);
-	*result = buffer;
-	return length;
 }
 
-static float float_from_string(const char *s)
+MappedFile::~MappedFile()
 {
-	if (strchr(s, 'e'))
-		return Parameter::valueFromString(std::string(s));
-	float rez = 0, fact = 1;
-	if (*s == '-'){
-		s++;
-		fact = -1;
-	};
-	for (int point_seen = 0; *s; s++){
-		if (*s == '.'){
-			point_seen = 1;
-			continue;
-		};
-		int d = *s - '0';
-		if (d >= 0 && d <= 9){
-			if (point_seen) fact /= 10.0f;
-			rez = rez * 10.0f + (float)d;
-		};
-	};
-	return rez * fact;
+#ifndef _WIN32
+	if (mapped_) {
+		munmap((void *) data_, size_);
+		return;
+	}
+#endif
+	free((void *) data_);
 }
 
-static bool readBankFile(const char *filename, Preset *presets)
+// Reports problems found in a bank file, without flooding stderr if the file
+// is badly damaged.
+class BankFileErrors {
+public:
+	static constexpr int kMaxReported = 10;
+
+	explicit BankFileErrors(const char *source) : source_(source) {}
+
+	~BankFileErrors() {
+		if (count_ > kMaxReported)
+			fprintf(stderr, "amsynth: %s: %d more errors not shown\n", source_, count_ - kMaxReported);
+	}
+
+	void report(int line, const char *message) {
+		if (++count_ <= kMaxReported)
+			fprintf(stderr, "amsynth: %s:%d: %s\n", source_, line, message);
+	}
+
+private:
+	const char *source_;
+	int count_ = 0;
+};
+
+static bool starts_with(const char *str, size_t length, const char *prefix, size_t prefix_length)
 {
-	void *buffer = nullptr;
-	off_t buffer_length = file_read_contents(filename, &buffer);
-	if (!buffer)
-		return false;
+	return length >= prefix_length && memcmp(str, prefix, prefix_length) == 0;
+}
 
-	if (memcmp(buffer, amsynth_file_header, sizeof(amsynth_file_header)) != 0) {
-		free(buffer);
+bool
+PresetBank::parse(const char *data, size_t length, const char *source)
+{
+	static const char preset_prefix[] = "<preset> <name> ";
+	static const char parameter_prefix[] = "<parameter> ";
+	static const char end_marker[] = "EOF";
+
+	BankFileErrors errors(source);
+
+	if (!starts_with(data, length, amsynth_file_header, sizeof(amsynth_file_header))) {
+		errors.report(1, "not an amsynth bank file");
 		return false;
 	}
 
-	char *buffer_end = ((char *)buffer) + buffer_length;
-
+	const char *end = data + length;
 	int preset_index = -1;
-	char *line_ptr = (char *)buffer + sizeof(amsynth_file_header);
-	for (char *end_ptr = line_ptr; end_ptr < buffer_end && *end_ptr; end_ptr++) {
-		if (*end_ptr == '\n') {
-			*end_ptr = '\0';
-			end_ptr++;
-
-			static char preset_prefix[] = "<preset> <name> ";
-			if (strncmp(line_ptr, preset_prefix, sizeof(preset_prefix) - 1) == 0) {
-				assert(preset_index < 127);
-				presets[++preset_index] = Preset(std::string(line_ptr + sizeof(preset_prefix) - 1));
+	int line_number = 1;
+	for (const char *line = data + sizeof(amsynth_file_header), *next; line < end; line = next) {
+		line_number++;
+		const char *line_end = (const char *) memchr(line, '\n', end - line);
+		next = line_end ? line_end + 1 : end;
+		if (!line_end)
+			line_end = end;
+		if (line_end > line && line_end[-1] == '\r')
+			line_end--;
+		size_t line_length = line_end - line;
+
+		if (starts_with(line, line_length, preset_prefix, sizeof(preset_prefix) - 1)) {
+			if (++preset_index >= PresetController::kNumPresets) {
+				errors.report(line_number, "too many presets");
+				return false;
 			}
+			presets[preset_index].setName(std::string(line + sizeof(preset_prefix) - 1, line_end));
+			continue;
+		}
 
-			static char parameter_prefix[] = "<parameter> ";
-			if (strncmp(line_ptr, parameter_prefix, sizeof(parameter_prefix) - 1) == 0) {
-				char *ptr = line_ptr + sizeof(parameter_prefix) - 1;
-				char *sep = strchr(ptr, ' ');
-				if (sep) {
-					Preset &preset = presets[preset_index];
-					Parameter &param = preset.getParameter(std::string(ptr, sep - ptr));
-					float fval = float_from_string(sep + 1);
-					param.setValue(fval);
-				}
+		if (starts_with(line, line_length, parameter_prefix, sizeof(parameter_prefix) - 1)) {
+			if (preset_index < 0) {
+				errors.report(line_number, "parameter outside of a preset");
+				return false;
 			}
-
-			line_ptr = end_ptr;
+			const char *name = line + sizeof(parameter_prefix) - 1;
+			const char *sep = (const char *) memchr(name, ' ', line_end - name);
+			int parameter = sep ? parameter_index_from_name_len(name, sep - name) : -1;
+			float value = 0.f;
+			if (parameter == -1)
+				errors.report(line_number, "unknown parameter");
+			else if (Parameter::parseValue(sep + 1, line_end, value) != line_end)
+				errors.report(line_number, "invalid parameter value");
+			else
+				presets[preset_index].getParameter(parameter).setValue(value);
+			continue;
 		}
+
+		if (line_length == sizeof(end_marker) - 1 && memcmp(line, end_marker, line_length) == 0)
+			break;
+
+		if (line_length)
+			errors.report(line_number, "unrecognised line");
 	}
-	for (preset_index++; preset_index < PresetController::kNumPresets; preset_index++)
-		presets[preset_index] = Preset();
-	free(buffer);
 
 	return true;
 }
 
+static bool readBankFile(const char *filename, PresetBank &bank)
+{
+	MappedFile file(filename);
+	if (!file.data())
+		return false;
+	return bank.parse(file.data(), file.size(), filename);
+}
+
 int
 PresetController::loadPresets		(const char *filename)
 {
+	adoptRealtimeBank();
 	if (filename == nullptr)
 		filename = bank_file.c_str();
 
-	long int fileModifiedTime = mtime(filename);
-	if (strcmp(filename, bank_file.c_str()) == 0 && lastPresetsFileModifiedTime == fileModifiedTime)
-		return 0; // file not modified since last load
-
-	if (!readBankFile(filename, presets))
+	auto bank = loadSharedBank(filename);
+	if (!bank)
 		return -1;
 
+	presets = bank;
 	currentBankNo = -1;
 	const std::vector<BankInfo> &banks = getPresetBanks();
 	for (int i = 0; i < (int) banks.size(); i++) {
@@ -382,37 +676,470 @@ PresetController::loadPresets		(const char *filename)
 			break;
 		}
 	}
+	publishBank();
+	setCurrPresetNumber(currentPresetNo);
+	releaseRetiredPresets();
 
-	lastPresetsFileModifiedTime = fileModifiedTime;
-	bank_file = std::string(filename);
+	if (filename != bank_file.c_str())
+		bank_file.assign(filename);
 
 	return 0;
 }
 
-void
+bool
 PresetController::selectBank(int bankNumber)
 {
-	const std::vector<BankInfo> &banks = getPresetBanks();
+	std::unique_lock<std::mutex> lock(s_banksMutex, std::try_to_lock);
+	if (!lock.owns_lock())
+		return false;
 
-	if (bankNumber >= (int) banks.size())
-		return;
+	const std::vector<BankInfo> &banks = s_banks;
+
+	if (bankNumber < 0 || bankNumber >= (int) banks.size())
+		return false;
+
+	std::unique_lock<std::mutex> realtimeLock(realtimeMutex, std::try_to_lock);
+	if (!realtimeLock.owns_lock())
+		return false;
+
+	if (realtimeBankNo == bankNumber)
+		return true;
+
+	// realtimeBankFile has capacity reserved so that assigning it does not allocate
+	const std::string &file_path = banks[bankNumber].file_path;
+	if (file_path.size() > realtimeBankFile.capacity())
+		return false;
+
+	// While the lock is held, a bank that is still in s_banks cannot be freed
+	// by dropping our reference. Otherwise the outgoing bank may hold the last
+	// reference (a bank dropped from s_banks by a rescan), so it is handed
+	// over to be released on another thread. If nothing has released the
+	// previous ones yet, the switch is refused rather than freeing here.
+	const bool shared = realtimeBankNo >= 0 && realtimeBankNo < (int) banks.size() && banks[realtimeBankNo].presets == realtimePresets;
+	if (!shared) {
+		const unsigned write = retiredBanksWrite.load(std::memory_order_relaxed);
+		if (write - retiredBanksRead.load(std::memory_order_acquire) == kMaxRetiredBanks)
+			return false;
+		retiredBanks[write % kMaxRetiredBanks] = std::move(realtimePresets);
+		retiredBanksWrite.store(write + 1, std::memory_order_release);
+	}
+
+	realtimePresets = banks[bankNumber].presets;
+	realtimeBankNo = bankNumber;
+	realtimeBankFile.assign(file_path);
+	realtimeBankSelected = true;
+	return true;
+}
+
+///////////////////////////////////
+
+// Every bank file is parsed at most once per modification; the resulting
+// snapshot is shared by all PresetControllers (i.e. all plugin instances).
+//
+// Where possible the bank directories are watched for changes, so cached
+// banks can be trusted without checking the file each time they're loaded.
+// Otherwise the file's modification time is compared on every load.
+struct SharedBank {
+	FileStamp stamp;
+	std::shared_ptr<const PresetBank> bank;
+};
+
+static std::mutex s_sharedBanksMutex;
+static std::map<std::string, SharedBank> s_sharedBanks;
+
+static std::mutex s_watcherMutex;
+static FileWatcher *s_watcher;
+static int s_watcherUsers;
+static std::atomic<unsigned> s_banksChangeCount;
+
+static bool isWatched(const std::string &file_path)
+{
+	std::lock_guard<std::mutex> lock(s_watcherMutex);
+	return s_watcher && s_watcher->isWatching(file_path);
+}
+
+static void watchBanksDirectory(const std::string &dir_path)
+{
+	std::lock_guard<std::mutex> lock(s_watcherMutex);
+	if (s_watcher)
+		s_watcher->watch(dir_path);
+}
+
+static std::shared_ptr<const PresetBank> loadSharedBank(const std::string &file_path)
+{
+	bool watched = isWatched(file_path);
+
+	std::lock_guard<std::mutex> lock(s_sharedBanksMutex);
+	SharedBank &shared = s_sharedBanks[file_path];
+	if (shared.bank && watched)
+		return shared.bank; // the watcher would have replaced it if modified
+
+	FileStamp stamp = file_stamp(file_path.c_str());
+	if (shared.bank && shared.stamp == stamp)
+		return shared.bank; // file not modified since last load
+
+	auto newBank = std::make_shared<PresetBank>();
+	if (!readBankFile(file_path.c_str(), *newBank))
+		return nullptr;
+	newBank->updateValues();
+
+	shared.stamp = stamp;
+	shared.bank = newBank;
+	return newBank;
+}
 
-	if (currentBankNo == bankNumber)
+static void publishSharedBank(const std::string &file_path, const std::shared_ptr<const PresetBank> &bank)
+{
+	std::lock_guard<std::mutex> lock(s_sharedBanksMutex);
+	s_sharedBanks[file_path] = SharedBank{file_stamp(file_path.c_str()), bank};
+}
+
+// Called on the watcher thread when a file in one of the bank directories is
+// written, renamed or deleted - by this or another process. file_path is
+// empty if the watcher lost track of changes.
+static void bankFileDidChange(const std::string &file_path)
+{
+	// Any activity in the banks directories is a chance to release banks
+	// retired on the audio thread
+	PresetController::releaseRetiredBanks();
+
+	if (file_path.empty()) {
+		// Any of the banks may have changed, so they are all read again
+		{
+			std::lock_guard<std::mutex> lock(s_sharedBanksMutex);
+			s_sharedBanks.clear();
+		}
+		s_banksChangeCount++;
 		return;
+	}
+
+	if (file_path[file_path.find_last_of('/') + 1] == '.')
+		return; // hidden, e.g. a temporary file used while saving
+
+	FileStamp stamp = file_stamp(file_path.c_str());
+	{
+		std::lock_guard<std::mutex> lock(s_sharedBanksMutex);
+		auto it = s_sharedBanks.find(file_path);
+		if (it != s_sharedBanks.end() && it->second.stamp == stamp)
+			return; // saved by this process, and already published
+	}
 
-	for (int i = 0; i < kNumPresets; i++)
-		presets[i] = banks[bankNumber].presets[i];
+	// Parse the new contents here rather than on the GUI thread
+	std::shared_ptr<PresetBank> bank;
+	if (is_amsynth_file(file_path.c_str())) {
+		bank = std::make_shared<PresetBank>();
+		if (readBankFile(file_path.c_str(), *bank))
+			bank->updateValues();
+		else
+			bank.reset();
+	}
 
-	currentBankNo = bankNumber;
-	bank_file = banks[bankNumber].file_path;
-	lastPresetsFileModifiedTime = mtime(banks[bankNumber].file_path.c_str());
+	{
+		std::lock_guard<std::mutex> lock(s_sharedBanksMutex);
+		if (bank)
+			s_sharedBanks[file_path] = SharedBank{stamp, bank};
+		else
+			s_sharedBanks.erase(file_path);
+	}
+
+	s_banksChangeCount++;
+}
+
+unsigned
+PresetController::getBanksChangeCount()
+{
+	return s_banksChangeCount;
 }
 
 ///////////////////////////////////
 
-static std::vector<BankInfo> s_banks;
+// Bank files are written on a background thread so that saving never blocks
+// the GUI. If saves of the same file queue up, only the latest is written.
+// The thread exits once the queue is empty, so nothing is left running when
+// a plugin binary is unloaded.
+// Each request is numbered, and the numbers of requests whose write failed
+// are kept, so that any number of callers can wait for the same requests
+// and each of them sees the failures.
+class BankWriter {
+public:
+	~BankWriter();
+
+	// Returns the number of the new request
+	uint64_t enqueue(const std::string &file_path, const std::shared_ptr<const PresetBank> &bank);
+
+	uint64_t lastRequest();
+
+	// Waits for requests up to and including last to be written. Returns
+	// false if the write of any request numbered after `after` failed.
+	bool wait(uint64_t after, uint64_t last);
+
+private:
+	struct Write {
+		std::shared_ptr<const PresetBank> bank;
+		std::vector<uint64_t> requests; // the requests this write completes
+	};
+
+	void run();
+	bool isWriting(uint64_t request) const;
+
+	std::mutex mutex_;
+	std::condition_variable condition_;
+	std::map<std::string, Write> queue_;
+	std::thread thread_;
+	bool running_ = false;
+	uint64_t requests_ = 0;
+	uint64_t writing_ = 0; // first request covered by the current write, or 0
+	std::vector<uint64_t> failures_;
+};
+
+// Contents of the bank files last written, so that when saving a bank which
+// differs by a single preset only that preset is formatted again.
+// Only accessed by the BankWriter thread.
+struct SerializedBank {
+	bool valid[PresetController::kNumPresets];
+	std::string names[PresetController::kNumPresets];
+	float values[PresetController::kNumPresets][kAmsynthParameterCount];
+	std::string text[PresetController::kNumPresets];
+};
+
+static std::map<std::string, std::unique_ptr<SerializedBank>> s_serializedBanks;
+
+static void serialize_preset(std::string &result, const Preset &preset)
+{
+	std::ostringstream stream;
+	stream.imbue(std::locale::classic());
+	stream << "<preset> " << "<name> " << preset.getName() << "\n";
+	for (int n = 0; n < kAmsynthParameterCount; n++)
+		stream << "<parameter> " << preset.getParameter(n).getName() << " " << preset.getParameter(n).getValue() << "\n";
+	result = stream.str();
+}
+
+static std::string serialize_bank(const std::string &file_path, const PresetBank &bank)
+{
+	auto &serialized = s_serializedBanks[file_path];
+	if (!serialized)
+		serialized.reset(new SerializedBank());
+
+	std::string contents(amsynth_file_header, sizeof(amsynth_file_header));
+	for (int i = 0; i < PresetController::kNumPresets; i++) {
+		const Preset &preset = bank[i];
+		if (preset.getName() == "unused")
+			continue;
+		if (!serialized->valid[i] ||
+			serialized->names[i] != preset.getName() ||
+			memcmp(serialized->values[i], bank.values[i], sizeof(bank.values[i])) != 0) {
+			serialize_preset(serialized->text[i], preset);
+			serialized->names[i] = preset.getName();
+			memcpy(serialized->values[i], bank.values[i], sizeof(bank.values[i]));
+			serialized->valid[i] = true;
+		}
+		contents += serialized->text[i];
+	}
+	contents += "EOF\n";
+	return contents;
+}
 
-static void scan_preset_bank(const std::string dir_path, const std::string file_name, bool read_only)
+// Writes to a temporary file which then replaces the original, so a crash
+// while saving can never leave a partially written bank behind.
+// The temporary file is hidden, so it is ignored when scanning for banks.
+// willReplace is called with the complete temporary file just before it
+// replaces the original.
+static bool write_file_atomically(const char *filename, const std::string &contents,
+								  const std::function<void(const char *temp_path)> &willReplace)
+{
+#ifdef _WIN32
+	std::string path(filename);
+	std::string::size_type pos = path.find_last_of("\\/") + 1;
+	std::string temp_path = path.substr(0, pos) + "." + path.substr(pos) + ".tmp";
+	FILE *file = fopen(temp_path.c_str(), "wb");
+	if (!file)
+		return false;
+	bool ok = fwrite(contents.data(), 1, contents.size(), file) == contents.size();
+	ok = fflush(file) == 0 && _commit(_fileno(file)) == 0 && ok;
+	ok = fclose(file) == 0 && ok;
+	if (ok)
+		willReplace(temp_path.c_str());
+	ok = ok && MoveFileExA(temp_path.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+	if (!ok)
+		remove(temp_path.c_str());
+	return ok;
+#else
+	// If the bank is a symlink, replace the file it points to rather than the link
+	char *resolved = realpath(filename, nullptr);
+	std::string path(resolved ? resolved : filename);
+	free(resolved);
+
+	std::string::size_type pos = path.find_last_of('/') + 1;
+	std::string dir_path = pos > 1 ? path.substr(0, pos - 1) : pos ? "/" : ".";
+	std::string temp_path = path.substr(0, pos) + "." + path.substr(pos) + ".XXXXXX";
+	int fd = mkstemp(&temp_path[0]);
+	if (fd == -1)
+		return false;
+
+	struct stat st;
+	fchmod(fd, stat(path.c_str(), &st) == 0 ? (st.st_mode & 07777) : 0644);
+
+	bool ok = true;
+	for (size_t written = 0; ok && written < contents.size(); ) {
+		ssize_t count = write(fd, contents.data() + written, contents.size() - written);
+		if (count == -1 && errno == EINTR)
+			continue;
+		ok = count > 0;
+		written += ok ? count : 0;
+	}
+	ok = ok && fsync(fd) == 0;
+	ok = close(fd) == 0 && ok;
+	if (ok)
+		willReplace(temp_path.c_str());
+	ok = ok && rename(temp_path.c_str(), path.c_str()) == 0;
+	if (!ok) {
+		unlink(temp_path.c_str());
+		return false;
+	}
+
+	// Make the rename itself durable
+	int dir_fd = open(dir_path.c_str(), O_RDONLY);
+	if (dir_fd != -1) {
+		fsync(dir_fd);
+		close(dir_fd);
+	}
+	return true;
+#endif
+}
+
+static bool writeBankFile(const std::string &file_path, const std::shared_ptr<const PresetBank> &bank)
+{
+	// The bank was published before being written. Its new file stamp is
+	// recorded before the file is moved into place (renaming keeps the stamp),
+	// so that the watcher can never see this write before knowing it as our own.
+	auto recordStamp = [&] (const char *temp_path) {
+		std::lock_guard<std::mutex> lock(s_sharedBanksMutex);
+		auto it = s_sharedBanks.find(file_path);
+		if (it != s_sharedBanks.end() && it->second.bank == bank)
+			it->second.stamp = file_stamp(temp_path);
+	};
+	if (!write_file_atomically(file_path.c_str(), serialize_bank(file_path, *bank), recordStamp)) {
+		fprintf(stderr, "amsynth: could not save %s: %s\n", file_path.c_str(), strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+BankWriter::~BankWriter()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	condition_.wait(lock, [this] { return !running_; });
+	lock.unlock();
+	if (thread_.joinable())
+		thread_.join();
+}
+
+uint64_t
+BankWriter::enqueue(const std::string &file_path, const std::shared_ptr<const PresetBank> &bank)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	uint64_t request = ++requests_;
+	auto it = queue_.find(file_path);
+	if (it != queue_.end()) {
+		// Supersedes the queued write, so its result is also the result of
+		// the requests that write covered
+		it->second.bank = bank;
+		it->second.requests.push_back(request);
+	} else {
+		queue_[file_path] = Write{bank, {request}};
+	}
+	if (running_)
+		return request;
+	if (thread_.joinable())
+		thread_.join(); // has already finished
+	running_ = true;
+	thread_ = std::thread(&BankWriter::run, this);
+	return request;
+}
+
+uint64_t
+BankWriter::lastRequest()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return requests_;
+}
+
+bool
+BankWriter::isWriting(uint64_t request) const
+{
+	if (writing_ && writing_ <= request)
+		return true;
+	for (auto &entry : queue_)
+		if (entry.second.requests.front() <= request)
+			return true;
+	return false;
+}
+
+bool
+BankWriter::wait(uint64_t after, uint64_t last)
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	condition_.wait(lock, [&] { return !isWriting(last); });
+	for (uint64_t failure : failures_)
+		if (failure > after && failure <= last)
+			return false;
+	return true;
+}
+
+void
+BankWriter::run()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	while (!queue_.empty()) {
+		auto it = queue_.begin();
+		std::string file_path = it->first;
+		Write write = std::move(it->second);
+		queue_.erase(it);
+		writing_ = write.requests.front();
+
+		lock.unlock();
+		bool ok = writeBankFile(file_path, write.bank);
+		write.bank.reset(); // may be the last reference
+		lock.lock();
+
+		if (!ok)
+			failures_.insert(failures_.end(), write.requests.begin(), write.requests.end());
+		writing_ = 0;
+		condition_.notify_all();
+	}
+	running_ = false;
+	condition_.notify_all();
+}
+
+static BankWriter & bankWriter()
+{
+	static BankWriter writer;
+	return writer;
+}
+
+static uint64_t queueBankWrite(const std::string &file_path, const std::shared_ptr<const PresetBank> &bank)
+{
+	return bankWriter().enqueue(file_path, bank);
+}
+
+static bool waitForBankWrite(uint64_t request)
+{
+	return bankWriter().wait(request - 1, request);
+}
+
+bool
+PresetController::waitForPendingSaves()
+{
+	// Each thread is told about the failures since its previous call
+	static thread_local uint64_t waited = 0;
+	BankWriter &writer = bankWriter();
+	uint64_t last = writer.lastRequest();
+	bool ok = writer.wait(waited, last);
+	waited = last;
+	return ok;
+}
+
+static void scan_preset_bank(std::vector<BankInfo> &banks, const std::string dir_path, const std::string file_name, bool read_only)
 {
 	std::string file_path = dir_path + std::string("/") + std::string(file_name);
 
@@ -434,11 +1161,13 @@ static void scan_preset_bank(const std::string dir_path, const std::string file_
 	bank_info.name = bank_name;
 	bank_info.file_path = file_path;
 	bank_info.read_only = read_only;
-	readBankFile(file_path.c_str(), bank_info.presets);
-	s_banks.push_back(bank_info);
+	bank_info.presets = loadSharedBank(file_path);
+	if (!bank_info.presets)
+		bank_info.presets = blankBank();
+	banks.push_back(bank_info);
 }
 
-static void scan_preset_banks(const std::string dir_path, bool read_only)
+static void scan_preset_banks(std::vector<BankInfo> &banks, const std::string dir_path, bool read_only)
 {
 	std::vector<std::string> filenames;
 
@@ -462,19 +1191,26 @@ static void scan_preset_banks(const std::string dir_path, bool read_only)
 	closedir(dir);
 #endif
 
+	// hidden files include those used while saving, see write_file_atomically
+	filenames.erase(std::remove_if(filenames.begin(), filenames.end(), [] (const std::string &name) {
+		return name.empty() || name[0] == '.';
+	}), filenames.end());
 	std::sort(filenames.begin(), filenames.end());
 
+	watchBanksDirectory(dir_path);
+
 	for (auto &filename : filenames)
-		scan_preset_bank(dir_path, filename, read_only);
+		scan_preset_bank(banks, dir_path, filename, read_only);
 }
 
 std::string sFactoryBanksDirectory;
 
 static void scan_preset_banks()
 {
-	s_banks.clear();
+	// Unmodified banks are picked up from the shared cache rather than parsed again.
+	std::vector<BankInfo> banks;
 	auto userBanksDirectory = PresetController::getUserBanksDirectory();
-	scan_preset_banks(userBanksDirectory, false);
+	scan_preset_banks(banks, userBanksDirectory, false);
 #ifdef PKGDATADIR
 	if (sFactoryBanksDirectory.empty())
 		sFactoryBanksDirectory = std::string(PKGDATADIR "/banks");
@@ -487,14 +1223,47 @@ static void scan_preset_banks()
 #endif
 	// sFactoryBanksDirectory == userBanksDirectory if the build is configured with a --prefix=$HOME/.local
 	if (!sFactoryBanksDirectory.empty() && sFactoryBanksDirectory != userBanksDirectory ) {
-		scan_preset_banks(sFactoryBanksDirectory, true);
+		scan_preset_banks(banks, sFactoryBanksDirectory, true);
+	}
+	{
+		std::lock_guard<std::mutex> lock(s_banksMutex);
+		s_banks.swap(banks);
+		s_banksScanned = true;
 	}
+	// the previous list is destroyed here, outside the lock
+	PresetController::releaseRetiredBanks();
+}
+
+// The watcher thread runs while any PresetController exists, so it is stopped
+// before a plugin binary can be unloaded.
+static void retainBankWatcher()
+{
+	std::lock_guard<std::mutex> lock(s_watcherMutex);
+	if (s_watcherUsers++)
+		return;
+	s_watcher = new FileWatcher(bankFileDidChange);
+	if (!s_watcher->watch(PresetController::getUserBanksDirectory()))
+		return;
+	if (!sFactoryBanksDirectory.empty())
+		s_watcher->watch(sFactoryBanksDirectory);
+	// Banks may have changed while nothing was watching
+	std::lock_guard<std::mutex> sharedBanksLock(s_sharedBanksMutex);
+	s_sharedBanks.clear();
+}
+
+static void releaseBankWatcher()
+{
+	std::lock_guard<std::mutex> lock(s_watcherMutex);
+	if (--s_watcherUsers)
+		return;
+	delete s_watcher;
+	s_watcher = nullptr;
 }
 
 const std::vector<BankInfo> &
 PresetController::getPresetBanks()
 {
-	if (s_banks.empty())
+	if (!s_banksScanned)
 		scan_preset_banks();
 	return s_banks;
 }
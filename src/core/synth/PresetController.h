@@ -22,6 +22,10 @@
 #ifndef _PRESETCONTROLLER_H
 #define _PRESETCONTROLLER_H
 
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
 #include <set>
 #include <stack>
 #include <string>
@@ -29,13 +33,36 @@
 
 #include "Preset.h"
 
+// The contents of a bank file. Banks are parsed once and the resulting
+// snapshot is shared (read-only) by every PresetController in the process.
+struct PresetBank {
+	Preset presets[128];
+
+	// Flat copy of every preset's parameter values, so that a preset can be
+	// applied on the audio thread without touching the Preset objects.
+	float values[128][kAmsynthParameterCount];
+
+	// Must be called after modifying presets.
+	void updateValues();
+
+	// Parses the contents of a bank file into this (default constructed) bank.
+	// Problems are reported to stderr, naming `source` as the file. Returns false
+	// if the data is not a usable bank.
+	bool parse(const char *data, size_t length, const char *source);
+
+	Preset & operator[](int preset) { return presets[preset]; }
+	const Preset & operator[](int preset) const { return presets[preset]; }
+};
+
 struct BankInfo {
 	~BankInfo();
 
 	std::string name;
 	std::string file_path;
 	bool read_only;
-	Preset presets[128];
+	std::shared_ptr<const PresetBank> presets;
+
+	const Preset & getPreset(int preset) const { return (*presets)[preset]; }
 };
 
 class PresetController final : private Parameter::Observer {
@@ -44,6 +71,7 @@ public:
 	static constexpr int kNumPresets = 128;
 
 	PresetController();
+	~PresetController();
 
 	class Observer {
 	public:
@@ -57,6 +85,12 @@ public:
 	 * an error value is returned. */
 	int		selectPreset		(const int preset);
 
+	// Realtime-safe variant of selectPreset for use on the audio thread (MIDI
+	// program change). Parameter values are applied from the bank's precomputed
+	// snapshot; nothing is allocated or freed. Observers are not notified and the
+	// undo history is discarded by the next non-realtime call that uses it.
+	int		selectPresetRealtime	(const int preset);
+
 	// returns the preset currently being edited
 	Preset&	getCurrentPreset	() { return currentPreset; }
 	
@@ -65,14 +99,25 @@ public:
 	void	setCurrentPreset	(const Preset &preset) { currentPreset = preset; }
 	
 	// access presets in the memory bank
-	Preset&	getPreset			(int preset) { return presets[preset]; }
+	const Preset& getPreset		(int preset);
 
 	bool	containsPresetWithName(const std::string name);
-	bool	isCurrentPresetModified() { return currentPresetNo != -1 && !currentPreset.isEqual(presets[currentPresetNo]); }
+	bool	isCurrentPresetModified();
+
+	// As above, for use on the audio thread. Compares against a copy of the
+	// stored values taken when the preset was selected, committed or its bank
+	// reloaded, so it neither reads the bank nor compares names. Renames are
+	// only seen if made through setCurrentPresetName.
+	bool	isCurrentPresetModifiedRealtime() const;
+
+	// Renames the current preset - not realtime safe
+	void	setCurrentPresetName	(const std::string &name);
 	
-	// Commit the current preset to memory
-	void	commitPreset		() { presets[currentPresetNo] = currentPreset; notify(); }
+	// Commit the current preset to memory. The shared bank is never modified,
+	// this instance gets its own copy of the bank instead.
+	void	commitPreset		();
 
+	// Commits the current preset and saves the bank in the background
 	void	saveCurrentPreset	();
 
 	// Resets all parameters to default value and clears the name.
@@ -90,23 +135,43 @@ public:
 	int		importPreset		(const std::string filename);
 	
 	// Loading & Saving of bank files - NOT REALTIME SAFE
+	// savePresets returns once the file has been written.
 	int		loadPresets			(const char *filename = NULL);
 	int		savePresets			(const char *filename = NULL);
 
-	// Switch bank at runtime - safe to call on audio thread
-	void	selectBank			(int bankNumber);
+	// Waits for saves started by saveCurrentPreset or clearPreset to complete.
+	// Returns false if any save started since the calling thread last called
+	// this has failed.
+	static bool waitForPendingSaves();
+
+	// Switch bank at runtime - safe to call on audio thread. Returns true if
+	// bankNumber is now the current bank. Has no effect while the bank list is
+	// being rescanned or another thread is updating the current bank, or if
+	// too many switches have happened since retired banks were last released.
+	// The other methods pick the new bank up the next time they are called.
+	bool	selectBank			(int bankNumber);
+
+	// Releases the banks that selectBank has switched away from, in every
+	// PresetController. Not realtime safe; called when banks are rescanned
+	// or change on disk, and by the non-realtime methods above.
+	static void releaseRetiredBanks();
 
 	void	addObserver			(Observer *observer) { observers.insert(observer); }
 	void	removeObserver		(Observer *observer) { observers.erase(observer); }
 
     int		getCurrPresetNumber	() { return currentPresetNo; }
-	void	setCurrPresetNumber (int num) { currentPresetNo = num; }
+	void	setCurrPresetNumber (int num);
 
-	const std::string & getFilePath() { return bank_file; }
+	const std::string & getFilePath() { adoptRealtimeBank(); return bank_file; }
 
 	static const std::vector<BankInfo> & getPresetBanks();
 	static void rescanPresetBanks();
 
+	// Incremented whenever a bank file is modified, created or removed other than
+	// by this process (e.g. by another amsynth process). Poll it to know when to
+	// call rescanPresetBanks and reload the current bank.
+	static unsigned getBanksChangeCount();
+
     static std::string getUserBanksDirectory();
 
 	static bool createUserBank(const std::string &name);
@@ -117,15 +182,50 @@ public:
 	}
 
 private:
+	uint64_t saveInBackground	();
+
 	std::string		bank_file;
 	std::set<Observer *> observers;
-	Preset			presets[kNumPresets];
+	std::shared_ptr<const PresetBank> presets;
 	Preset 			currentPreset;
 	Preset			blankPreset;
 	Preset 			nullpreset{"null preset"};
 	int				currentBankNo = -1;
-	int 			currentPresetNo = -1;
-	long int 		lastPresetsFileModifiedTime = 0;
+	std::atomic<int> currentPresetNo{-1};
+
+	// The audio thread's copy of the current bank. selectBank and
+	// selectPresetRealtime use only these, under a try_lock of realtimeMutex,
+	// and never touch presets, bank_file or currentBankNo. publishBank hands
+	// the bank over after the other methods change it, and adoptRealtimeBank
+	// takes back a bank chosen by selectBank.
+	std::mutex		realtimeMutex;
+	std::shared_ptr<const PresetBank> realtimePresets;
+	int				realtimeBankNo = -1;
+	std::string		realtimeBankFile;
+	bool			realtimeBankSelected = false;
+
+	void	publishBank			();
+	void	adoptRealtimeBank	();
+	std::atomic<bool> changeBuffersInvalid{false};
+
+	// selectBank hands the outgoing bank over here rather than dropping it, as
+	// it may hold the last reference. Written only by the audio thread and
+	// emptied by releaseRetiredPresets on another.
+	static constexpr unsigned kMaxRetiredBanks = 16;
+	std::shared_ptr<const PresetBank> retiredBanks[kMaxRetiredBanks];
+	std::atomic<unsigned> retiredBanksRead{0};
+	std::atomic<unsigned> retiredBanksWrite{0};
+
+	// Copies of the current preset's stored values and whether its name
+	// differs, read by isCurrentPresetModifiedRealtime
+	std::atomic<float> selectedValues[kAmsynthParameterCount];
+	std::atomic<bool> selectedNameModified{false};
+
+	void	captureSelectedPreset	(const PresetBank &bank);
+
+	void	releaseRetiredPresets	();
+	void	drainRetiredBanks		();
+	void	clearInvalidChangeBuffers	() { if (changeBuffersInvalid.exchange(false)) clearChangeBuffers(); }
 
 	// Parameter::Observer
 	void parameterWillChange(const Parameter &) final;
@@ -0,0 +1,57 @@
+/*
+ *  SynthStatus.h
+ *
+ *  Copyright (c) 2023 Nick Dowell
+ *
+ *  This file is part of amsynth.
+ *
+ *  amsynth is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  amsynth is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with amsynth.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SYNTHSTATUS_H
+#define _SYNTHSTATUS_H
+
+#include <atomic>
+
+/*
+ * Meter and state information published by Synthesizer::process at the end
+ * of every buffer. Each field is an independent lock-free atomic, so a GUI or
+ * host can poll it from any thread without touching the synth itself.
+ */
+struct SynthStatus
+{
+	// Highest absolute output sample since the last call to takePeak
+	std::atomic<float> peakLeft {0};
+	std::atomic<float> peakRight {0};
+
+	std::atomic<int> activeVoices {0};
+
+	// Time spent rendering the last buffer as a fraction of its duration
+	std::atomic<float> dspLoad {0};
+
+	// Whether the current preset differs from the copy in its bank
+	std::atomic<bool> presetModified {false};
+
+	static float takePeak(std::atomic<float> &peak) { return peak.exchange(0, std::memory_order_relaxed); }
+
+	// Only called by the thread running Synthesizer::process. Retries rather
+	// than storing, so that a takePeak reset in between is not overwritten.
+	static void updatePeak(std::atomic<float> &peak, float value)
+	{
+		float current = peak.load(std::memory_order_relaxed);
+		while (value > current && !peak.compare_exchange_weak(current, value, std::memory_order_relaxed)) {}
+	}
+};
+
+#endif
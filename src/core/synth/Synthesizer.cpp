@@ -25,9 +25,13 @@
 #include "PresetController.h"
 #include "VoiceAllocationUnit.h"
 #include "VoiceBoard.h"
+#include "VoiceBudget.h"
+#include "core/Configuration.h"
 
 #include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <cmath>
 #include <cstdio>
 #include <cstring>
 
@@ -40,6 +44,9 @@ Synthesizer::Synthesizer()
 {
 	_voiceAllocationUnit = new VoiceAllocationUnit;
 	_voiceAllocationUnit->SetSampleRate((int) _sampleRate);
+	_voiceAllocationUnit->setVoiceBudget(&VoiceBudget::global());
+	_voiceAllocationUnit->setInaudibleThreshold((float) Configuration::get().voice_inaudible_threshold);
+	_voiceAllocationUnit->setOversampling(Configuration::get().oversampling);
 
 	_presetController = new PresetController;
 	_presetController->getCurrentPreset().addObserver(_voiceAllocationUnit);
@@ -255,32 +262,75 @@ void Synthesizer::setSampleRate(int sampleRate)
 	_voiceAllocationUnit->SetSampleRate(sampleRate);
 }
 
+void Synthesizer::setAccumulate(bool accumulate, float gain)
+{
+	_voiceAllocationUnit->setAccumulate(accumulate, gain);
+}
+
+void Synthesizer::prepare(int sampleRate, unsigned /*maxBlockSize*/)
+{
+	// process() renders in sub-blocks of VoiceBoard::kMaxProcessBufferSize
+	// frames, and every buffer the DSP uses is sized for one sub-block, so
+	// nothing here depends on the host block size.
+	setSampleRate(sampleRate);
+}
+
+int Synthesizer::getLatency()
+{
+	return (int) lroundf(_voiceAllocationUnit->getLatency());
+}
+
+int Synthesizer::lockMemory()
+{
+	return _voiceAllocationUnit->lockMemory();
+}
+
 void Synthesizer::process(unsigned int nframes,
 						  const std::vector<amsynth_midi_event_t> &midi_in,
 						  std::vector<amsynth_midi_cc_t> &midi_out,
 						  float *audio_l, float *audio_r, unsigned audio_stride)
+{
+	static const std::vector<amsynth_parameter_event_t> no_parameters;
+	process(nframes, midi_in, no_parameters, midi_out, audio_l, audio_r, audio_stride);
+}
+
+void Synthesizer::process(unsigned int nframes,
+						  const std::vector<amsynth_midi_event_t> &midi_in,
+						  const std::vector<amsynth_parameter_event_t> &parameters_in,
+						  std::vector<amsynth_midi_cc_t> &midi_out,
+						  float *audio_l, float *audio_r, unsigned audio_stride)
 {
 	if (_sampleRate < 0) {
 		assert(nullptr == "sample rate has not been set");
 		return;
 	}
+	const auto start = std::chrono::steady_clock::now();
 	if (needsResetAllVoices_) {
 		needsResetAllVoices_ = false;
 		_voiceAllocationUnit->resetAllVoices();
 	}
 	std::vector<amsynth_midi_event_t>::const_iterator event = midi_in.begin();
+	std::vector<amsynth_parameter_event_t>::const_iterator parameter = parameters_in.begin();
 	unsigned frames_left_in_buffer = nframes, frame_index = 0;
 	while (frames_left_in_buffer) {
 		while (event != midi_in.end() && event->offset_frames <= frame_index) {
 			_midiController->HandleMidiData(event->buffer, event->length);
 			++event;
 		}
+		while (parameter != parameters_in.end() && parameter->offset_frames <= frame_index) {
+			setParameterValue((Param)parameter->parameter, parameter->value);
+			++parameter;
+		}
 		
 		unsigned block_size_frames = std::min(frames_left_in_buffer, (unsigned)VoiceBoard::kMaxProcessBufferSize);
 		if (event != midi_in.end() && event->offset_frames > frame_index) {
 			unsigned frames_until_next_event = event->offset_frames - frame_index;
 			block_size_frames = std::min(block_size_frames, frames_until_next_event);
 		}
+		if (parameter != parameters_in.end() && parameter->offset_frames > frame_index) {
+			unsigned frames_until_next_parameter = parameter->offset_frames - frame_index;
+			block_size_frames = std::min(block_size_frames, frames_until_next_parameter);
+		}
 		
 		_voiceAllocationUnit->Process(audio_l + (frame_index * audio_stride),
 									  audio_r + (frame_index * audio_stride),
@@ -293,5 +343,32 @@ void Synthesizer::process(unsigned int nframes,
 		_midiController->HandleMidiData(event->buffer, event->length);
 		++event;
 	}
+	while (parameter != parameters_in.end()) {
+		setParameterValue((Param)parameter->parameter, parameter->value);
+		++parameter;
+	}
 	_midiController->generateMidiOutput(midi_out);
+	const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	publishStatus(nframes, audio_l, audio_r, audio_stride, elapsed.count());
+}
+
+void Synthesizer::publishStatus(unsigned nframes, const float *audio_l, const float *audio_r, unsigned audio_stride, double seconds)
+{
+	float peak_l = 0, peak_r = 0;
+	if (_voiceAllocationUnit->getAccumulate()) {
+		// the buffers also hold whatever the caller is mixing us into
+		peak_l = _voiceAllocationUnit->takeAccumulatedPeak(0);
+		peak_r = _voiceAllocationUnit->takeAccumulatedPeak(1);
+	} else {
+		for (unsigned i = 0; i < nframes; i++) {
+			peak_l = std::max(peak_l, fabsf(audio_l[i * audio_stride]));
+			peak_r = std::max(peak_r, fabsf(audio_r[i * audio_stride]));
+		}
+	}
+	SynthStatus::updatePeak(status_.peakLeft, peak_l);
+	SynthStatus::updatePeak(status_.peakRight, peak_r);
+	status_.activeVoices.store(_voiceAllocationUnit->countActiveVoices(), std::memory_order_relaxed);
+	if (nframes)
+		status_.dspLoad.store((float)(seconds * _sampleRate / nframes), std::memory_order_relaxed);
+	status_.presetModified.store(_presetController->isCurrentPresetModifiedRealtime(), std::memory_order_relaxed);
 }
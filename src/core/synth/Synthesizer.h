@@ -24,6 +24,7 @@
 
 #include "core/controls.h"
 #include "core/types.h"
+#include "SynthStatus.h"
 
 #include <map>
 #include <string>
@@ -98,11 +99,39 @@ public:
 
 	void setSampleRate(int sampleRate);
 
+	// Sets the sample rate and the largest number of frames that will be
+	// passed to process(). Not realtime safe; call before processing starts.
+	void prepare(int sampleRate, unsigned maxBlockSize);
+
+	// Delay in frames between an event and the start of the sound it
+	// produces, introduced by oversampling. Hosts should compensate for it.
+	int getLatency();
+
+	// Locks the voices, effects and buffers into RAM so that rendering never
+	// waits for a page fault. Returns 0 on success, or -1 if the OS refused.
+	int lockMemory();
+
 	void process(unsigned nframes,
 				 const std::vector<amsynth_midi_event_t> &midi_in,
 				 std::vector<amsynth_midi_cc_t> &midi_out,
 				 float *audio_l, float *audio_r, unsigned audio_stride = 1);
 
+	// When accumulate is set, process() adds its output multiplied by gain to
+	// audio_l and audio_r, e.g. to mix several instances into a bus without
+	// intermediate buffers. Otherwise the output overwrites them.
+	void setAccumulate(bool accumulate, float gain = 1.0f);
+
+	// As above, also applying parameter changes at their frame offsets.
+	// Both event lists must be sorted by offset_frames.
+	void process(unsigned nframes,
+				 const std::vector<amsynth_midi_event_t> &midi_in,
+				 const std::vector<amsynth_parameter_event_t> &parameters_in,
+				 std::vector<amsynth_midi_cc_t> &midi_out,
+				 float *audio_l, float *audio_r, unsigned audio_stride = 1);
+
+    // Updated at the end of every process() call, safe to read from any thread
+    SynthStatus &getStatus() { return status_; }
+
     MidiController *getMidiController() { return _midiController; };
     PresetController *getPresetController() { return _presetController; }
 
@@ -115,8 +144,11 @@ public:
 	
 private:
 
+	void publishStatus(unsigned nframes, const float *audio_l, const float *audio_r, unsigned audio_stride, double seconds);
+
 	bool needsResetAllVoices_ = false;
 	Properties propertyStore_;
+	SynthStatus status_;
 };
 
 #endif /* defined(__amsynth__Synthesizer__) */
@@ -19,6 +19,7 @@
  *  along with amsynth.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 #include <fstream>
@@ -36,6 +37,7 @@ TuningMap::TuningMap		()
 void
 TuningMap::defaultScale		()
 {
+	scaleFile.clear();
 	scale.clear();
 	for (int i = 1; i <= 12; ++i)
 		scale.push_back(pow(2., i/12.));
@@ -45,6 +47,7 @@ TuningMap::defaultScale		()
 void
 TuningMap::defaultKeyMap	()
 {
+	keyMapFile.clear();
 	zeroNote = 0;
 	refNote = 69;
 	refPitch = 440.;
@@ -61,12 +64,52 @@ TuningMap::updateBasePitch	()
 	if (mapping.empty())
 		return; // must be just initializing
 	basePitch = 1.;
-	basePitch = refPitch / noteToPitch(refNote);
+	basePitch = refPitch / computePitch(refNote);
 	// Clever, huh?
+	publishTable();
+}
+
+void
+TuningMap::publishTable		()
+{
+	std::unique_ptr<Table> newTable(new Table);
+	for (int note = 0; note < 128; note++) {
+		newTable->pitch[note] = computePitch(note);
+		newTable->active[note] = activeRange[note];
+	}
+	newTable->isDefault = scaleFile.empty() && keyMapFile.empty();
+
+	std::unique_ptr<const Table> previous = std::move(currentTable);
+	currentTable = std::move(newTable);
+	table.store(currentTable.get());
+
+	// Any read that starts from now on gets the new table, so of the replaced
+	// ones only the table marked in use may still be read
+	const Table *inUse = tableInUse.load();
+	if (previous.get() == inUse)
+		retiredTable = std::move(previous);
+	else if (retiredTable.get() != inUse)
+		retiredTable.reset();
+}
+
+const TuningMap::Table *
+TuningMap::acquireTable		() const
+{
+	// Marks the table in use before checking that it is still current, so
+	// that publishTable either sees the mark or this sees the new table.
+	// Both sides use sequentially consistent operations for this.
+	const Table *current = table.load();
+	for (;;) {
+		tableInUse.store(current);
+		const Table *latest = table.load();
+		if (latest == current)
+			return current;
+		current = latest;
+	}
 }
 
 double
-TuningMap::noteToPitch		(int note) const
+TuningMap::computePitch		(int note) const
 {
 	assert(note >= 0 && note < 128);
 	assert(!mapping.empty());
@@ -198,12 +241,9 @@ TuningMap::loadKeyMap		(const std::string & filename)
 	int newMapRepeatInc = -1;
 	std::vector<int> newMapping;
 
-	// It makes more sense to manipulate the ActiveRange array directly instead of creating
-	// a temporary container and pointing the actual array to it at the end because
-	// doing so would require dynamic memory allocation.
+	// Only applied if the whole file is valid
+	bool newActiveRange[128] = {false};
 	bool rangeDeclared = false;
-	for (int i = 0; i < 128; i++)
-		activeRange[i] = false;
 
 	while (file.good())
 	{
@@ -227,7 +267,8 @@ TuningMap::loadKeyMap		(const std::string & filename)
 			if ((min >= 0) && (max < 128) && (min <= max)) // No overlap is checked for; it wouldn't hurt anything if ranges overlapped.
 			{
 				rangeDeclared = true;
-				activateRange(min, max);
+				for (int note = min; note <= max; note++)
+					newActiveRange[note] = true;
 			}
 			else
 			{
@@ -301,6 +342,9 @@ TuningMap::loadKeyMap		(const std::string & filename)
 		mapRepeatInc = 1;
 		mapping.clear();
 		mapping.push_back(0);
+		std::copy(newActiveRange, newActiveRange + 128, activeRange);
+		if (!rangeDeclared)
+			activateRange(0, 127);
 		updateBasePitch();
 		return 0;
 	}
@@ -318,6 +362,7 @@ TuningMap::loadKeyMap		(const std::string & filename)
 	if (newMapping[refIndex] < 0)
 		return -1;
 
+	keyMapFile = filename;
 	zeroNote = newZeroNote;
 	refNote = newRefNote;
 	refPitch = newRefPitch;
@@ -327,6 +372,7 @@ TuningMap::loadKeyMap		(const std::string & filename)
 	else
 		mapRepeatInc = newMapRepeatInc;
 
+	std::copy(newActiveRange, newActiveRange + 128, activeRange);
 	if (!rangeDeclared) // Will default to a full active range if none are declared.
 		activateRange(0, 127);
 
@@ -22,6 +22,9 @@
 #ifndef _TUNINGMAP_H
 #define _TUNINGMAP_H
 
+#include <atomic>
+#include <cassert>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -52,11 +55,13 @@ public:
 	const std::string & getScaleFile() const { return scaleFile; }
 	const std::string & getKeyMapFile() const { return keyMapFile; }
 
-	bool	isDefault		() const { return scaleFile.empty() && keyMapFile.empty(); }
+	// These are safe to call from the audio thread while the tuning is changed.
+	// Only one thread may call them.
+	bool	isDefault		() const { return acquireTable()->isDefault; }
 
-	double	noteToPitch		(int note) const;
+	double	noteToPitch		(int note) const { assert(note >= 0 && note < 128); return acquireTable()->pitch[note]; }
 
-	bool	inActiveRange   (int note) const { return activeRange[note]; }
+	bool	inActiveRange   (int note) const { return acquireTable()->active[note]; }
 
 private:
 	std::string scaleFile;
@@ -76,6 +81,26 @@ private:
 	double			basePitch;
 	void			updateBasePitch		();
 	void			activateRange(int min, int max); // Activates the given ranges inclusively.
+	double			computePitch		(int note) const;
+
+	// Everything the audio thread needs, computed from the above whenever it
+	// changes and published with a single atomic store.
+	struct Table {
+		double	pitch[128];
+		bool	active[128];
+		bool	isDefault;
+	};
+	std::atomic<const Table *>	table{nullptr};
+	std::unique_ptr<const Table>	currentTable;
+
+	// The table the audio thread read last, which it may still be using. A
+	// replaced table is kept only while it is this one, so at most one is
+	// kept besides the current table.
+	mutable std::atomic<const Table *>	tableInUse{nullptr};
+	std::unique_ptr<const Table>	retiredTable;
+
+	const Table *	acquireTable		() const;
+	void			publishTable		();
 };
 
 #endif
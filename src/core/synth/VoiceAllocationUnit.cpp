@@ -24,19 +24,30 @@
 #include "Distortion.h"
 #include "SoftLimiter.h"
 #include "VoiceBoard.h"
+#include "VoiceBudget.h"
 #include "freeverb/revmodel.hpp"
 
 #ifdef WITH_MTS_ESP
 #include "MTS-ESP/Client/libMTSClient.h"
 #endif
 
+#include <algorithm>
 #include <assert.h>
+#include <cstdint>
 #include <cstring>
 #include <iostream>
 #include <math.h>
 
 
-const unsigned kBufferSize = 1024;
+// Process() renders at most one voice sub-block at a time
+const unsigned kBufferSize = VoiceBoard::kMaxProcessBufferSize;
+
+static const size_t kArenaSize =
+	MemoryArena::sizeFor(sizeof(VoiceBoard)) * VoiceAllocationUnit::kNumVoices +
+	MemoryArena::sizeFor(sizeof(SoftLimiter)) +
+	MemoryArena::sizeFor(sizeof(revmodel)) +
+	MemoryArena::sizeFor(sizeof(Distortion)) +
+	MemoryArena::sizeFor(sizeof(float) * kBufferSize * 2);
 
 
 VoiceAllocationUnit::VoiceAllocationUnit ()
@@ -45,27 +56,56 @@ VoiceAllocationUnit::VoiceAllocationUnit ()
 ,	mPortamentoMode(PortamentoModeAlways)
 ,	sustain (0)
 ,	_keyboardMode(KeyboardModePoly)
+,	mArena (kArenaSize)
 ,	mMasterVol (1.0)
 ,	mPanGainLeft(1)
 ,	mPanGainRight(1)
+,	mVoicePanSpread(0)
+,	mVoicePanMode(VoicePanModeKey)
+,	mVoicePanRandom(22222)
+,	mUnisonVoices(1)
+,	mUnisonSpread(0)
 ,	mPitchBendRangeSemitones(2)
-,	mPitchBendValue(1)
 ,	mLastNoteFrequency (0.0f)
+,	_voiceBudget (nullptr)
+,	mVoicePriority (0)
+,	mReservedVoices (0)
+,	_stealRequests (0)
+,	_publishedVoiceCount (0)
+,	_publishedStealCandidateLevel (0)
+,	mMasterEffectsEnabled (true)
+,	mInaudibleThreshold (0)
+,	mAccumulate (false)
+,	mAccumulateGain (1)
+,	mAccumulatedPeak {0, 0}
 #ifdef WITH_MTS_ESP
 ,	mtsClient(MTS_RegisterClient())
 #endif
 {
-	limiter = new SoftLimiter;
-	reverb = new revmodel;
-	distortion = new Distortion;
-	mBuffer = new float [kBufferSize * 2];
+	// The voices come first as they are walked on every block
+	_voices.reserve (kNumVoices);
+	for (int i = 0; i < kNumVoices; i++)
+		_voices.push_back (mArena.create<VoiceBoard>());
+	limiter = mArena.create<SoftLimiter>();
+	reverb = mArena.create<revmodel>();
+	distortion = mArena.create<Distortion>();
+	mBuffer = (float *) mArena.allocate (sizeof(float) * kBufferSize * 2);
+
+	for (int i = 0; i < kNumVoices; i++)
+	{
+		active[i] = false;
+		_voiceKey[i] = -1;
+	}
 
-	for (int i = 0; i < 128; i++)
+	for (int i = 0; i < kNumKeys; i++)
 	{
 		keyPressed[i] = false;
-		active[i] = false;
-		_voices.push_back (new VoiceBoard);
+		_keyPitch[i] = 0;
+		_keyVoice[i] = -1;
 	}
+
+	for (int i = 0; i < kNumChannels; i++)
+		mPitchBendValue[i] = 1;
 	
 	memset(&_keyPresses, 0, sizeof(_keyPresses));
 
@@ -77,11 +117,24 @@ VoiceAllocationUnit::~VoiceAllocationUnit	()
 #ifdef WITH_MTS_ESP
 	MTS_DeregisterClient(mtsClient);
 #endif
-	while (_voices.size()) { delete _voices.back(); _voices.pop_back(); }
-	delete limiter;
-	delete reverb;
-	delete distortion;
-	delete [] mBuffer;
+	setVoiceBudget(nullptr);
+	for (VoiceBoard *voice : _voices) MemoryArena::destroy(voice);
+	MemoryArena::destroy(limiter);
+	MemoryArena::destroy(reverb);
+	MemoryArena::destroy(distortion);
+}
+
+void
+VoiceAllocationUnit::setOversampling	(int factor)
+{
+	distortion->setOversampling(factor);
+	for (unsigned i=0; i<_voices.size(); ++i) _voices[i]->setOversampling(factor);
+}
+
+float
+VoiceAllocationUnit::getLatency	() const
+{
+	return _voices[0]->getLatency() + distortion->getLatency();
 }
 
 void
@@ -93,25 +146,136 @@ VoiceAllocationUnit::SetSampleRate	(int rate)
 }
 
 void
-VoiceAllocationUnit::HandleMidiNoteOn(int note, float velocity)
+VoiceAllocationUnit::setInaudibleThreshold	(float dBFS)
+{
+	mInaudibleThreshold = dBFS < 0 ? powf(10.f, dBFS / 20.f) : 0;
+}
+
+void
+VoiceAllocationUnit::setVoiceBudget	(VoiceBudget *budget)
 {
+	if (_voiceBudget)
+		_voiceBudget->removeVoiceAllocationUnit(this);
+	_voiceBudget = budget;
+	if (_voiceBudget)
+		_voiceBudget->addVoiceAllocationUnit(this);
+}
+
+int
+VoiceAllocationUnit::countActiveVoices	() const
+{
+	int count = 0;
+	for (int i=0; i<kNumVoices; i++)
+		count += active[i] ? 1 : 0;
+	return count;
+}
+
+int
+VoiceAllocationUnit::allocateVoice()
+{
+	unsigned count = 0;
+	int idx = -1;
+	for (int i=0; i<kNumVoices; i++) {
+		if (active[i])
+			count++;
+		else if (idx < 0)
+			idx = i;
+	}
+
+	unsigned maxVoices = (0 < mMaxVoices && mMaxVoices < kNumVoices) ? (unsigned) mMaxVoices : kNumVoices;
+	if (0 <= idx && count < maxVoices) {
+		if (!_voiceBudget || !_voiceBudget->isExhausted())
+			return idx;
+		if (_voiceBudget->requestVoiceFrom(this))
+			return idx;
+		if (count < (unsigned) mReservedVoices)
+			return idx;
+		if (count == 0)
+			return -1; // every voice in the budget belongs to more important units
+	}
+
+	return stealVoice();
+}
+
+int
+VoiceAllocationUnit::stealVoice()
+{
+	int idx = findVoiceToSteal();
+	assert(0 <= idx && idx < kNumVoices);
+	releaseVoice(idx);
+	return idx;
+}
+
+int
+VoiceAllocationUnit::findVoiceToSteal() const
+{
+	// Prefers the quietest voice, and the oldest of equally quiet voices
+	auto findQuietest = [this] (bool releasedOnly) {
+		int idx = -1;
+		float level = 0;
+		unsigned keyPress = 0;
+		for (int i=0; i<kNumVoices; i++) {
+			if (!active[i] || (releasedOnly && keyPressed[_voiceKey[i]]))
+				continue;
+			const float voiceLevel = fabsf(_voices[i]->getAmplitude());
+			const unsigned voiceKeyPress = _keyPresses[_voiceKey[i]];
+			if (idx < 0 || voiceLevel < level || (voiceLevel == level && voiceKeyPress < keyPress)) {
+				idx = i;
+				level = voiceLevel;
+				keyPress = voiceKeyPress;
+			}
+		}
+		return idx;
+	};
+	// strategy 1) find the quietest voice in release phase
+	int idx = findQuietest(true);
+	// strategy 2) find the quietest voice
+	if (idx < 0)
+		idx = findQuietest(false);
+	return idx;
+}
+
+void
+VoiceAllocationUnit::publishVoiceCount()
+{
+	_publishedVoiceCount = countActiveVoices();
+	int idx = findVoiceToSteal();
+	_publishedStealCandidateLevel = idx < 0 ? 0.f : _voices[idx]->getAmplitude();
+}
+
+void
+VoiceAllocationUnit::releaseVoice(int voice)
+{
+	int key = _voiceKey[voice];
+	if (0 <= key && _keyVoice[key] == voice)
+		_keyVoice[key] = -1;
+	_voiceKey[voice] = -1;
+	active[voice] = false;
+}
+
+void
+VoiceAllocationUnit::HandleMidiNoteOn(int channel, int note, float velocity)
+{
+	assert (0 <= channel && channel < kNumChannels);
 	assert (note >= 0);
 	assert (note < 128);
 
 	// Checks if the note is within the note ranges activated in the current keyboard map.
 	// The above assertions guarantee the safety of this check.
-	if (!shouldPlayNote(note))
+	if (!shouldPlayNote(channel, note))
 		return;
 
-	float pitch = (float) noteToPitch(note);
+	float pitch = (float) noteToPitch(channel, note);
 	if (pitch < 0) { // unmapped key
 		return;
 	}
+
+	const int key = channel * 128 + note;
 	
 	float portamentoTime = mPortamentoTime;
 	if (mPortamentoMode == PortamentoModeLegato) {
 		int count = 0;
-		for (int i=0; i<128; i++) {
+		for (int i=0; i<kNumKeys; i++) {
 			if (keyPressed[i]) {
 				count++;
 			}
@@ -121,120 +285,104 @@ VoiceAllocationUnit::HandleMidiNoteOn(int note, float velocity)
 		}
 	}
 	
-	keyPressed[note] = true;
+	keyPressed[key] = true;
+	_keyPitch[key] = pitch;
 	
 	if (_keyboardMode == KeyboardModePoly) {
 
-		if (mMaxVoices) {
-			unsigned count = 0;
-			for (int i=0; i<128; i++)
-				count = count + (active[i] ? 1 : 0);
-			if (count >= (unsigned) mMaxVoices) {
-				int idx = -1;
-				// strategy 1) find the oldest voice in release phase
-				unsigned keyPress = _keyPressCounter + 1;
-				for (int i=0; i<128; i++) {
-					if (active[i] && !keyPressed[i]) {
-						if (keyPress > _keyPresses[i]) {
-							keyPress = _keyPresses[i];
-							idx = i;
-						}
-					}
-				}
-				if (idx < 0) {
-					// strategy 2) find the oldest voice
-					keyPress = _keyPressCounter + 1;
-					for (int i=0; i<128; i++) {
-						if (active[i]) {
-							if (keyPress > _keyPresses[i]) {
-								keyPress = _keyPresses[i];
-								idx = i;
-							}
-						}
-					}
-				}
-				assert(0 <= idx && idx < 128);
-				active[idx] = false;
-			}
+		int voice = _keyVoice[key];
+		if (voice < 0) {
+			voice = allocateVoice();
+			if (voice < 0)
+				return;
+			_voices[voice]->reset();
+			_keyVoice[key] = (int16_t) voice;
+			_voiceKey[voice] = (int16_t) key;
 		}
 
-		_keyPresses[note] = (++_keyPressCounter);
+		_keyPresses[key] = (++_keyPressCounter);
 
 		if (mLastNoteFrequency > 0.0f) {
-			_voices[note]->setFrequency(mLastNoteFrequency, pitch, portamentoTime);
+			_voices[voice]->setFrequency(mLastNoteFrequency, pitch, portamentoTime);
 		} else {
-			_voices[note]->setFrequency(pitch, pitch, 0);
+			_voices[voice]->setFrequency(pitch, pitch, 0);
 		}
-
-		if (_voices[note]->isSilent())
-			_voices[note]->reset();
 		
-		_voices[note]->setVelocity(velocity);
-		_voices[note]->triggerOn(true);
+		_voices[voice]->setVelocity(velocity);
+		_voices[voice]->setPan(voicePan(note, velocity));
+		_voices[voice]->triggerOn(true);
 		
-		active[note] = true;
+		active[voice] = true;
 	}
 	
 	if (_keyboardMode == KeyboardModeMono || _keyboardMode == KeyboardModeLegato) {
 
-		int previousNote = -1;
+		int previousKey = -1;
 		unsigned keyPress = 0;
-		for (int i = 0; i < 128; i++) {
+		for (int i = 0; i < kNumKeys; i++) {
 			if (keyPress < _keyPresses[i]) {
 				keyPress = _keyPresses[i];
-				previousNote = i;
+				previousKey = i;
 			}
 		}
 
-		_keyPresses[note] = (++_keyPressCounter);
+		_keyPresses[key] = (++_keyPressCounter);
 		
 		VoiceBoard *voice = _voices[0];
 		
 		voice->setVelocity(velocity);
+		voice->setPan(voicePan(note, velocity));
 		voice->setFrequency(voice->getFrequency(), pitch, portamentoTime);
 		
-		if (_keyboardMode == KeyboardModeMono || previousNote == -1)
+		if (_keyboardMode == KeyboardModeMono || previousKey == -1)
 			voice->triggerOn(!active[0]);
 		
 		active[0] = true;
+		_voiceKey[0] = (int16_t) key;
 	}
 
 	mLastNoteFrequency = pitch;
+
+	if (_voiceBudget)
+		publishVoiceCount();
 }
 
 void
-VoiceAllocationUnit::HandleMidiNoteOff(int note, float /*velocity*/)
+VoiceAllocationUnit::HandleMidiNoteOff(int channel, int note, float /*velocity*/)
 {
 	// No action is required if the note is outside the active range of notes.
-	if (!shouldPlayNote(note))
+	if (!shouldPlayNote(channel, note))
 		return;
 
-	keyPressed[note] = false;
+	const int key = channel * 128 + note;
+
+	keyPressed[key] = false;
 
 	if (sustain)
 		return;
 
 	if (_keyboardMode == KeyboardModePoly) {
-		_voices[note]->triggerOff();
+		if (0 <= _keyVoice[key])
+			_voices[_keyVoice[key]]->triggerOff();
 	}
 
 	if (_keyboardMode == KeyboardModeMono || _keyboardMode == KeyboardModeLegato) {
-		int currentNote = -1;
+		int currentKey = -1;
 		unsigned keyPress = 0;
-		for (int i = 0; i < 128; i++) {
+		for (int i = 0; i < kNumKeys; i++) {
 			if (keyPress < _keyPresses[i]) {
 				keyPress = _keyPresses[i];
-				currentNote = i;
+				currentKey = i;
 			}
 		}
 		
-		_keyPresses[note] = 0;
+		_keyPresses[key] = 0;
 		
-		int nextNote = -1;
-		for (unsigned i = 0, tmp = 0; i < 128; i++) {
+		int nextKey = -1;
+		for (unsigned i = 0, tmp = 0; i < kNumKeys; i++) {
 			if (tmp < _keyPresses[i] && (keyPressed[i] || sustain)) {
 				tmp = _keyPresses[i];
-				nextNote = i;
+				nextKey = i;
 			}
 		}
 		
@@ -242,16 +390,17 @@ VoiceAllocationUnit::HandleMidiNoteOff(int note, float /*velocity*/)
 			_keyPressCounter = 0;
 		}
 		
-		if (note != currentNote) {
+		if (key != currentKey) {
 			return;
 		}
 		
 		VoiceBoard *voice = _voices[0];
 		
-		if (0 <= nextNote) {
-			voice->setFrequency(voice->getFrequency(), (float) noteToPitch(nextNote), mPortamentoTime);
+		if (0 <= nextKey) {
+			voice->setFrequency(voice->getFrequency(), _keyPitch[nextKey], mPortamentoTime);
 			if (_keyboardMode == KeyboardModeMono)
 				voice->triggerOn(false);
+			_voiceKey[0] = (int16_t) nextKey;
 		} else {
 			voice->triggerOff();
 		}
@@ -259,9 +408,9 @@ VoiceAllocationUnit::HandleMidiNoteOff(int note, float /*velocity*/)
 }
 
 void
-VoiceAllocationUnit::HandleMidiPitchWheel(float value)
+VoiceAllocationUnit::HandleMidiPitchWheel(int channel, float value)
 {
-	mPitchBendValue = pow(2.0f, value * mPitchBendRangeSemitones / 12.0f);
+	mPitchBendValue[channel] = pow(2.0f, value * mPitchBendRangeSemitones / 12.0f);
 }
 
 void
@@ -289,9 +438,9 @@ VoiceAllocationUnit::HandleMidiSustainPedal(uchar value)
 	if ((sustain = (value > 0)))
 		return;
 
-	for (unsigned i = 0; i < _voices.size(); i++) {
+	for (int i = 0; i < kNumKeys; i++) {
 		if (!keyPressed[i] && _keyPresses[i] > 0) {
-			HandleMidiNoteOff(i, 0);
+			HandleMidiNoteOff(i / 128, i % 128, 0);
 		}
 	}
 }
@@ -301,12 +450,18 @@ VoiceAllocationUnit::resetAllVoices()
 {
 	for (unsigned i=0; i<_voices.size(); i++) {
 		active[i] = false;
+		_voiceKey[i] = -1;
+		_voices[i]->reset();
+	}
+	for (int i=0; i<kNumKeys; i++) {
 		keyPressed[i] = false;
 		_keyPresses[i] = 0;
-		_voices[i]->reset();
+		_keyVoice[i] = -1;
 	}
 	_keyPressCounter = 0;
 	sustain = false;
+	_stealRequests = 0;
+	_publishedVoiceCount = 0;
 }
 
 void
@@ -314,28 +469,114 @@ VoiceAllocationUnit::Process		(float *l, float *r, unsigned nframes, int stride)
 {
 	assert(nframes <= VoiceBoard::kMaxProcessBufferSize);
 
+	// Voices are only rendered in stereo when something places them apart
+	const bool stereo = isStereo();
+	float *right = mBuffer + kBufferSize;
+
 	memset(mBuffer, 0, nframes * sizeof (float));
+	if (stereo)
+		memset(right, 0, nframes * sizeof (float));
+
+	// Give up the voices that other units sharing our budget asked for
+	for (int steals = _stealRequests.exchange(0); 0 < steals && 0 < countActiveVoices(); steals--)
+		stealVoice();
 
 	for (unsigned i=0; i<_voices.size(); i++) {
 		if (active[i]) {
 			if (_voices[i]->isSilent()) {
-				active[i] = false;
+				releaseVoice(i);
 			} else {
-				_voices[i]->SetPitchBend(mPitchBendValue);
-				_voices[i]->ProcessSamplesMix (mBuffer, nframes, mMasterVol);
+				_voices[i]->SetPitchBend(mPitchBendValue[_voiceKey[i] / 128]);
+				if (stereo)
+					_voices[i]->ProcessSamplesMix (mBuffer, right, nframes, mMasterVol);
+				else
+					_voices[i]->ProcessSamplesMix (mBuffer, nframes, mMasterVol);
+				// Don't spend any more time on the inaudible tail of a release
+				if (_voices[i]->isInaudible(mInaudibleThreshold))
+					releaseVoice(i);
 			}
 		}
 	}
 
-	distortion->Process (mBuffer, nframes);
+	if (stereo)
+		distortion->Process (mBuffer, right, nframes);
+	else
+		distortion->Process (mBuffer, nframes);
+
+	if (mAccumulate) {
+		processAccumulate (l, r, nframes, stride, stereo);
+	} else {
+		const float *source = stereo ? right : mBuffer;
+		for (unsigned i=0; i<nframes; i++) {
+			l[i * stride] = mBuffer[i] * mPanGainLeft;
+			r[i * stride] = source[i] * mPanGainRight;
+		}
+
+		if (mMasterEffectsEnabled) {
+			reverb->processmix (l, r, l, r, nframes, stride);
+			limiter->Process (l,r, nframes, stride);
+		}
+	}
+
+	if (_voiceBudget)
+		publishVoiceCount();
+}
+
+void
+VoiceAllocationUnit::processAccumulate(float *l, float *r, unsigned nframes, int stride, bool stereo)
+{
+	float *right = mBuffer + kBufferSize;
+	float gainLeft = mAccumulateGain;
+	float gainRight = mAccumulateGain;
+
+	if (mMasterEffectsEnabled) {
+		// The effects need this unit's signal on its own, so they run on the
+		// internal buffers before the result is added to the outputs
+		const float *source = stereo ? right : mBuffer;
+		for (unsigned i=0; i<nframes; i++) {
+			right[i] = source[i] * mPanGainRight;
+			mBuffer[i] = mBuffer[i] * mPanGainLeft;
+		}
+		reverb->processmix (mBuffer, right, mBuffer, right, nframes, 1);
+		limiter->Process (mBuffer, right, nframes, 1);
+	} else {
+		if (!stereo)
+			right = mBuffer;
+		gainLeft *= mPanGainLeft;
+		gainRight *= mPanGainRight;
+	}
 
+	float peakLeft = mAccumulatedPeak[0];
+	float peakRight = mAccumulatedPeak[1];
 	for (unsigned i=0; i<nframes; i++) {
-		l[i * stride] = mBuffer[i] * mPanGainLeft;
-		r[i * stride] = mBuffer[i] * mPanGainRight;
+		const float outLeft = mBuffer[i] * gainLeft;
+		const float outRight = right[i] * gainRight;
+		l[i * stride] += outLeft;
+		r[i * stride] += outRight;
+		peakLeft = std::max(peakLeft, fabsf(outLeft));
+		peakRight = std::max(peakRight, fabsf(outRight));
 	}
+	mAccumulatedPeak[0] = peakLeft;
+	mAccumulatedPeak[1] = peakRight;
+}
 
-	reverb->processmix (l, r, l, r, nframes, stride);
-	limiter->Process (l,r, nframes, stride);
+float
+VoiceAllocationUnit::voicePan(int note, float velocity)
+{
+	float position = 0;
+	switch (mVoicePanMode) {
+	case VoicePanModeKey:
+		position = std::min(std::max((note - 60) / 48.f, -1.f), 1.f);
+		break;
+	case VoicePanModeVelocity:
+		position = velocity * 2.f - 1.f;
+		break;
+	case VoicePanModeRandom:
+		mVoicePanRandom = mVoicePanRandom * 196314165 + 907633515;
+		position = (float) mVoicePanRandom / (float) UINT32_MAX * 2.f - 1.f;
+		break;
+	}
+	return position * mVoicePanSpread;
 }
 
 void
@@ -362,6 +603,8 @@ VoiceAllocationUnit::parameterDidChange(const Parameter &parameter)
 	case kAmsynthParameter_PortamentoTime: 	mPortamentoTime = value; break;
 	case kAmsynthParameter_KeyboardMode:	setKeyboardMode((KeyboardMode)(int)value); break;
 	case kAmsynthParameter_PortamentoMode:	mPortamentoMode = (int) value; break;
+	case kAmsynthParameter_VoicePanSpread:	mVoicePanSpread = value; break;
+	case kAmsynthParameter_VoicePanMode:	mVoicePanMode = (int) value; break;
 
 	case kAmsynthParameter_AmpEnvAttack:
 	case kAmsynthParameter_AmpEnvDecay:
@@ -395,6 +638,21 @@ VoiceAllocationUnit::parameterDidChange(const Parameter &parameter)
 	case kAmsynthParameter_FilterKeyTrackAmount:
 	case kAmsynthParameter_FilterKeyVelocityAmount:
 	case kAmsynthParameter_AmpVelocityAmount:
+	case kAmsynthParameter_UnisonDetune:
+		for (unsigned i=0; i<_voices.size(); i++) {
+			_voices[i]->UpdateParameter (param, value);
+		}
+		break;
+
+	case kAmsynthParameter_UnisonVoices:
+		mUnisonVoices = (int) roundf(value);
+		for (unsigned i=0; i<_voices.size(); i++) {
+			_voices[i]->UpdateParameter (param, value);
+		}
+		break;
+
+	case kAmsynthParameter_UnisonSpread:
+		mUnisonSpread = value;
 		for (unsigned i=0; i<_voices.size(); i++) {
 			_voices[i]->UpdateParameter (param, value);
 		}
@@ -410,26 +668,30 @@ VoiceAllocationUnit::parameterDidChange(const Parameter &parameter)
 
 // Note: MTS-ESP wants us to supply a MIDI channel when querying retuning or
 // note filtering, in order to support multi-channel tuning tables which are
-// useful for microtonal MIDI controllers with more than 128 keys. We don't yet
-// support this because VoiceAllocationUnit uses the MIDI note number to index
-// _voices[], therefore notes playing on different channels could conflict.
+// useful for microtonal MIDI controllers with more than 128 keys. Voices are
+// keyed by channel and note, so the same note number on different channels
+// can be tuned independently and sound simultaneously.
 
 bool
-VoiceAllocationUnit::shouldPlayNote	(int note) const
+VoiceAllocationUnit::shouldPlayNote	(int channel, int note) const
 {
 #ifdef WITH_MTS_ESP
 	if (!mtsEspDisabled && tuningMap.isDefault())
-		return !MTS_ShouldFilterNote(mtsClient, note, 0);
+		return !MTS_ShouldFilterNote(mtsClient, (char) note, (char) channel);
+#else
+	(void) channel;
 #endif
 	return tuningMap.inActiveRange(note);
 }
 
 double
-VoiceAllocationUnit::noteToPitch	(int note) const
+VoiceAllocationUnit::noteToPitch	(int channel, int note) const
 {
 #ifdef WITH_MTS_ESP
 	if (!mtsEspDisabled && tuningMap.isDefault())
-		return MTS_NoteToFrequency(mtsClient, note, 0);
+		return MTS_NoteToFrequency(mtsClient, (char) note, (char) channel);
+#else
+	(void) channel;
 #endif
 	return tuningMap.noteToPitch(note);
 }
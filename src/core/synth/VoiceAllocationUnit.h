@@ -22,6 +22,7 @@
 #ifndef _VOICEALLOCATIONUNIT_H
 #define _VOICEALLOCATIONUNIT_H
 
+#include "MemoryArena.h"
 #include "MidiController.h"
 #include "TuningMap.h"
 
@@ -29,11 +30,13 @@
 #include "config.h"
 #endif
 
+#include <atomic>
 #include <stdint.h>
 #include <vector>
 
 
 class VoiceBoard;
+class VoiceBudget;
 class SoftLimiter;
 class revmodel;
 class Distortion;
@@ -49,9 +52,9 @@ public:
 
 	void	SetSampleRate		(int);
 	
-	void	HandleMidiNoteOn(int note, float velocity) override;
-	void	HandleMidiNoteOff(int note, float velocity) override;
-	void	HandleMidiPitchWheel(float value) override;
+	void	HandleMidiNoteOn(int channel, int note, float velocity) override;
+	void	HandleMidiNoteOff(int channel, int note, float velocity) override;
+	void	HandleMidiPitchWheel(int channel, float value) override;
 	void	HandleMidiPitchWheelSensitivity(uchar semitones) override;
 	void	HandleMidiAllSoundOff() override;
 	void	HandleMidiAllNotesOff() override;
@@ -61,32 +64,94 @@ public:
 	void	SetMaxVoices	(int voices) { mMaxVoices = voices; }
 	int		GetMaxVoices	() { return mMaxVoices; }
 
+	// Shares a polyphony limit with other units; may be null
+	void	setVoiceBudget	(VoiceBudget *);
+	int		countActiveVoices	() const;
+	// Frees the voice that is the best candidate to be stolen
+	int		stealVoice		();
+
+	// Units with a lower priority give up their voices first, but never below
+	// their number of reserved voices
+	void	setVoicePriority	(int priority) { mVoicePriority = priority; }
+	int		getVoicePriority	() const { return mVoicePriority; }
+	void	setReservedVoices	(int voices) { mReservedVoices = voices; }
+	int		getReservedVoices	() const { return mReservedVoices; }
+
+	// These are safe to call from any thread, for use by VoiceBudget
+	int		getBudgetedVoices	() const { return _publishedVoiceCount - _stealRequests; }
+	float	getStealCandidateLevel	() const { return _publishedStealCandidateLevel; }
+	void	requestStealVoice	() { _stealRequests++; }
+
+	// Voices are stopped once released and quieter than this level over a
+	// block, in dBFS; 0 keeps them until they are completely silent
+	void	setInaudibleThreshold	(float dBFS);
+
+	// When disabled, the reverb and limiter are left to the caller so they
+	// can be shared between several units
+	void	setMasterEffectsEnabled	(bool enabled) { mMasterEffectsEnabled = enabled; }
+
+	// Oversamples the voices and distortion by 1, 2 or 4; not realtime safe
+	void	setOversampling	(int factor);
+	// Delay of the output in samples, from the oversampling filters
+	float	getLatency		() const;
+
+	// Locks the voices, effects and buffers into RAM; returns 0 on success
+	int		lockMemory		() { return mArena.lock(); }
+
 	float	getPitchBendRangeSemitones() {return mPitchBendRangeSemitones;}
 	void	setPitchBendRangeSemitones(float range) { mPitchBendRangeSemitones = range; }
 	void	setKeyboardMode(KeyboardMode);
 
 	void	Process			(float *l, float *r, unsigned nframes, int stride=1);
 
-	bool	shouldPlayNote	(int note) const;
-	double	noteToPitch		(int note) const;
+	// When enabled, Process adds its output multiplied by gain to l and r
+	// instead of overwriting them, so several units can share a bus.
+	void	setAccumulate	(bool accumulate, float gain = 1.0f) { mAccumulate = accumulate; mAccumulateGain = gain; }
+	bool	getAccumulate	() const { return mAccumulate; }
+
+	// Highest absolute sample added to the outputs in accumulate mode since
+	// the last call; the caller's buffers also contain other sources.
+	float	takeAccumulatedPeak	(int channel) { float peak = mAccumulatedPeak[channel]; mAccumulatedPeak[channel] = 0; return peak; }
+
+	bool	shouldPlayNote	(int channel, int note) const;
+	double	noteToPitch		(int channel, int note) const;
 	int		loadScale		(const std::string & sclFileName);
 	int		loadKeyMap		(const std::string & kbmFileName);
 
+	static const int kNumChannels = 16;
+	static const int kNumVoices = 128;
+	// A key identifies a note on a particular channel: channel * 128 + note
+	static const int kNumKeys = kNumChannels * 128;
+
 // private:
 
 	void	resetAllVoices();
+	int		allocateVoice();
+	int		findVoiceToSteal() const;
+	void	publishVoiceCount();
+	void	releaseVoice(int voice);
+	bool	isStereo() const { return mVoicePanSpread > 0.f || (mUnisonVoices > 1 && mUnisonSpread > 0.f); }
+	float	voicePan(int note, float velocity);
+	void	processAccumulate(float *l, float *r, unsigned nframes, int stride, bool stereo);
 
 	int		mMaxVoices;
 
 	float	mPortamentoTime;
 	int		mPortamentoMode;
-	bool	keyPressed[128], sustain;
-	bool	active[128];
+	bool	keyPressed[kNumKeys], sustain;
+	bool	active[kNumVoices];
 	
 	unsigned	_keyboardMode;
-	unsigned	_keyPresses[128];
+	unsigned	_keyPresses[kNumKeys];
 	unsigned	_keyPressCounter;
+	float		_keyPitch[kNumKeys];	// frequency the key was tuned to when pressed
+	int16_t		_keyVoice[kNumKeys];	// voice sounding the key, or -1
+	int16_t		_voiceKey[kNumVoices];	// key sounded by the voice, or -1
 	
+	// Holds the voices, effects and buffers, so that the state touched while
+	// rendering is contiguous and can be locked into RAM
+	MemoryArena	mArena;
+
 	std::vector<VoiceBoard*>	_voices;
 	
 	SoftLimiter	*limiter;
@@ -98,10 +163,27 @@ public:
 	float	mMasterVol;
 	float	mPanGainLeft;
 	float	mPanGainRight;
+	float	mVoicePanSpread;
+	int		mVoicePanMode;
+	uint32_t	mVoicePanRandom;
+	int		mUnisonVoices;
+	float	mUnisonSpread;
 	float	mPitchBendRangeSemitones;
-	float	mPitchBendValue;
+	float	mPitchBendValue[kNumChannels];
 	float	mLastNoteFrequency;
 
+	VoiceBudget	*_voiceBudget;
+	std::atomic<int>	mVoicePriority;
+	std::atomic<int>	mReservedVoices;
+	std::atomic<int>	_stealRequests;
+	std::atomic<int>	_publishedVoiceCount;
+	std::atomic<float>	_publishedStealCandidateLevel;
+	bool	mMasterEffectsEnabled;
+	float	mInaudibleThreshold;
+	bool	mAccumulate;
+	float	mAccumulateGain;
+	float	mAccumulatedPeak[2];
+
 	TuningMap	tuningMap;
 #ifdef WITH_MTS_ESP
 	struct MTSClient *mtsClient;
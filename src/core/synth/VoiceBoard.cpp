@@ -21,6 +21,7 @@
 
 #include "VoiceBoard.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 
@@ -65,9 +66,11 @@ VoiceBoard::UpdateParameter	(Param param, float value)
     case kAmsynthParameter_LFOOscillatorSelect: mFreqModDestination = (int)roundf(value); break;
 	
 	case kAmsynthParameter_Oscillator1Waveform:	osc1.SetWaveform ((Oscillator::Waveform) (int)value);
+				osc1Unison.SetWaveform ((Oscillator::Waveform) (int)value);
 				break;
 	case kAmsynthParameter_Oscillator1Pulsewidth:	mOsc1PulseWidth = value;	break;
 	case kAmsynthParameter_Oscillator2Waveform:	osc2.SetWaveform ((Oscillator::Waveform) (int)value);
+				osc2Unison.SetWaveform ((Oscillator::Waveform) (int)value);
 				break;
 	case kAmsynthParameter_Oscillator2Pulsewidth:	mOsc2PulseWidth = value;	break;
 	case kAmsynthParameter_Oscillator2Octave:	mOsc2Octave = value;		break;
@@ -75,6 +78,10 @@ VoiceBoard::UpdateParameter	(Param param, float value)
 	case kAmsynthParameter_Oscillator2Pitch:	mOsc2Pitch = ::powf(2, value / 12); break;
 	case kAmsynthParameter_Oscillator2Sync:		mOsc2Sync  = roundf(value) != 0.f; break;
 
+	case kAmsynthParameter_UnisonVoices:	mUnisonVoices = (int)roundf(value); updateUnison(); break;
+	case kAmsynthParameter_UnisonDetune:	mUnisonDetune = value; updateUnison(); break;
+	case kAmsynthParameter_UnisonSpread:	mUnisonSpread = value; updateUnison(); break;
+
 	case kAmsynthParameter_LFOToFilterCutoff:	mFilterModAmt = (value+1.0f)/2.0f;break;
 	case kAmsynthParameter_FilterEnvAmount:	mFilterEnvAmt = value;		break;
 	case kAmsynthParameter_FilterCutoff:	mFilterCutoff = value;		break;
@@ -106,6 +113,8 @@ VoiceBoard::UpdateParameter	(Param param, float value)
 	case kAmsynthParameter_PortamentoTime:
 	case kAmsynthParameter_KeyboardMode:
 	case kAmsynthParameter_PortamentoMode:
+	case kAmsynthParameter_VoicePanSpread:
+	case kAmsynthParameter_VoicePanMode:
 		break;
 	case kAmsynthParameterCount:
 	default:
@@ -113,6 +122,13 @@ VoiceBoard::UpdateParameter	(Param param, float value)
 	}
 }
 
+void
+VoiceBoard::updateUnison()
+{
+	osc1Unison.setVoices(mUnisonVoices, mUnisonDetune, mUnisonSpread);
+	osc2Unison.setVoices(mUnisonVoices, mUnisonDetune, mUnisonSpread);
+}
+
 void
 VoiceBoard::SetPitchBend	(float val)
 {	
@@ -121,6 +137,26 @@ VoiceBoard::SetPitchBend	(float val)
 
 void
 VoiceBoard::ProcessSamplesMix	(float *buffer, int numSamples, float vol)
+{
+	processSamples(buffer, nullptr, numSamples, vol);
+}
+
+void
+VoiceBoard::ProcessSamplesMix	(float *left, float *right, int numSamples, float vol)
+{
+	processSamples(left, right, numSamples, vol);
+}
+
+void
+VoiceBoard::setPan	(float pan)
+{
+	// balance law: a centred voice is at unity gain in both channels, as in the mono path
+	mPanGainLeft = std::min(1.f, 1.f - pan);
+	mPanGainRight = std::min(1.f, 1.f + pan);
+}
+
+void
+VoiceBoard::processSamples	(float *left, float *right, int numSamples, float vol)
 {
 	assert(numSamples <= kMaxProcessBufferSize);
 
@@ -169,6 +205,9 @@ VoiceBoard::ProcessSamplesMix	(float *buffer, int numSamples, float vol)
 	//
 	// VCOs
 	//
+	// Oscillators, mixer and filter run at the oversampled rate
+	const int factor = mOversampling;
+	const int oversampledSamples = numSamples * factor;
 	float *osc1buf = mProcessBuffers.osc_1;
 	float *osc2buf = mProcessBuffers.osc_2;
 
@@ -178,8 +217,34 @@ VoiceBoard::ProcessSamplesMix	(float *buffer, int numSamples, float vol)
 	osc2sync &= (osc1.GetWaveform() == Oscillator::Waveform::kSine || osc1.GetWaveform() == Oscillator::Waveform::kSaw);
 	osc2.setSyncEnabled(osc2sync);
 
-	osc1.ProcessSamples (osc1buf, numSamples, osc1freq, osc1pw);
-	osc2.ProcessSamples (osc2buf, numSamples, osc2freq, osc2pw, osc1freq);
+	// With a stereo output and spread unison copies, the left and right
+	// oscillator mixes are kept apart and each gets its own filter
+	float *osc1right = mProcessBuffers.osc_1_right;
+	float *osc2right = mProcessBuffers.osc_2_right;
+	const bool splitUnison = right && mUnisonVoices > 1 && mUnisonSpread > 0.f;
+
+	if (mUnisonVoices > 1) {
+		osc1Unison.ProcessSamples (osc1buf, osc1right, oversampledSamples, osc1freq, osc1pw);
+		if (osc2sync) {
+			// sync needs a single master phase, so osc2 is not stacked
+			osc2.ProcessSamples (osc2buf, oversampledSamples, osc2freq, osc2pw, osc1freq);
+			for (int i=0; i<oversampledSamples; i++) {
+				osc2buf[i] *= 0.5f;
+				osc2right[i] = osc2buf[i];
+			}
+		} else {
+			osc2Unison.ProcessSamples (osc2buf, osc2right, oversampledSamples, osc2freq, osc2pw);
+		}
+		if (!splitUnison) {
+			for (int i=0; i<oversampledSamples; i++) {
+				osc1buf[i] += osc1right[i];
+				osc2buf[i] += osc2right[i];
+			}
+		}
+	} else {
+		osc1.ProcessSamples (osc1buf, oversampledSamples, osc1freq, osc1pw);
+		osc2.ProcessSamples (osc2buf, oversampledSamples, osc2freq, osc2pw, osc1freq);
+	}
 
 	//
 	// Osc Mix
@@ -189,28 +254,61 @@ VoiceBoard::ProcessSamplesMix	(float *buffer, int numSamples, float vol)
 		float oscMix = mOscMix.tick();
 		float osc1vol = (1.F - ringMod) * (1.F - oscMix) / 2.F;
 		float osc2vol = (1.F - ringMod) * (1.F + oscMix) / 2.F;
-		osc1buf[i] =
-			osc1vol * osc1buf[i] +
-			osc2vol * osc2buf[i] +
-			ringMod * osc1buf[i] * osc2buf[i];
+		for (int j=i*factor; j<(i+1)*factor; j++) {
+			osc1buf[j] =
+				osc1vol * osc1buf[j] +
+				osc2vol * osc2buf[j] +
+				ringMod * osc1buf[j] * osc2buf[j];
+			if (splitUnison) {
+				osc1right[j] =
+					osc1vol * osc1right[j] +
+					osc2vol * osc2right[j] +
+					ringMod * osc1right[j] * osc2right[j];
+			}
+		}
 	}
 
 	//
 	// VCF
 	//
-	filter.ProcessSamples (osc1buf, numSamples, cutoff, mFilterRes, mFilterType, mFilterSlope);
+	filter.ProcessSamples (osc1buf, oversampledSamples, cutoff, mFilterRes, mFilterType, mFilterSlope);
+	if (splitUnison)
+		filterRight.ProcessSamples (osc1right, oversampledSamples, cutoff, mFilterRes, mFilterType, mFilterSlope);
+
+	if (factor > 1) {
+		mOversamplerLeft.downsample (osc1buf, osc1buf, numSamples);
+		if (splitUnison)
+			mOversamplerRight.downsample (osc1right, osc1right, numSamples);
+	}
 	
 	//
 	// VCA
 	// 
 	float *ampenvbuf = mProcessBuffers.amp_env;
 	mAmpADSR.process(ampenvbuf, numSamples);
+	float envelopeLevel = 0;
 	for (int i=0; i<numSamples; i++) {
 		float ampModAmount = mAmpModAmount.tick();
-		const float amplitude = ampenvbuf[i] * BLEND(1.f, mKeyVelocity, mAmpVelSens.tick()) *
+		const float velocityEnvelope = ampenvbuf[i] * BLEND(1.f, mKeyVelocity, mAmpVelSens.tick());
+		const float amplitude = velocityEnvelope *
 			( ((lfo1buf[i] * 0.5f) + 0.5f) * ampModAmount + 1 - ampModAmount);
-		buffer[i] += osc1buf[i] * _vcaFilter.processSample(amplitude * mVolume.processSample(vol));
+		const float volume = mVolume.processSample(vol);
+		const float gain = _vcaFilter.processSample(amplitude * volume);
+		// Envelope, velocity and volume; the LFO can only reduce this
+		envelopeLevel = std::max(envelopeLevel, velocityEnvelope * volume);
+		const float output = osc1buf[i] * gain;
+		if (!right) {
+			left[i] += output;
+		} else if (splitUnison) {
+			const float outputRight = osc1right[i] * gain;
+			left[i] += output * mPanGainLeft;
+			right[i] += outputRight * mPanGainRight;
+		} else {
+			left[i] += output * mPanGainLeft;
+			right[i] += output * mPanGainRight;
+		}
 	}
+	mEnvelopeLevel = envelopeLevel;
 }
 
 void
@@ -218,14 +316,26 @@ VoiceBoard::SetSampleRate	(int rate)
 {
 	mSampleRate = rate;
 	lfo1.SetSampleRate (rate);
-	osc1.SetSampleRate (rate);
-	osc2.SetSampleRate (rate);
-	filter.SetSampleRate (rate);
+	osc1.SetSampleRate (rate * mOversampling);
+	osc2.SetSampleRate (rate * mOversampling);
+	osc1Unison.SetSampleRate (rate * mOversampling);
+	osc2Unison.SetSampleRate (rate * mOversampling);
+	filter.SetSampleRate (rate * mOversampling);
+	filterRight.SetSampleRate (rate * mOversampling);
 	mFilterADSR.SetSampleRate(rate);
 	mAmpADSR.SetSampleRate(rate);
 	_vcaFilter.setCoefficients(rate, kVCALowPassFreq, IIRFilterFirstOrder::Mode::kLowPass);
 }
 
+void
+VoiceBoard::setOversampling	(int factor)
+{
+	mOversamplerLeft.setFactor (factor);
+	mOversamplerRight.setFactor (factor);
+	mOversampling = mOversamplerLeft.getFactor();
+	SetSampleRate ((int) mSampleRate);
+}
+
 bool 
 VoiceBoard::isSilent()
 {
@@ -259,7 +369,12 @@ VoiceBoard::reset()
 	mFilterADSR.reset();
 	osc1.reset();
 	osc2.reset();
+	osc1Unison.reset();
+	osc2Unison.reset();
 	filter.reset();
+	filterRight.reset();
+	mOversamplerLeft.reset();
+	mOversamplerRight.reset();
 	lfo1.reset();
 }
 
@@ -26,6 +26,7 @@
 #include "ADSR.h"
 #include "Oscillator.h"
 #include "LowPassFilter.h"
+#include "Oversampler.h"
 #include "Synth--.h"
 
 /**
@@ -42,6 +43,12 @@ public:
 	static constexpr int kMaxProcessBufferSize = 64;
 
 	bool	isSilent		();
+	// The current gain of the VCA, including envelope and velocity
+	float	getAmplitude	() const { return _vcaFilter._z; }
+	// True if released and the amp envelope (with velocity and volume) stayed
+	// below threshold for the last block. The output itself is not used, as
+	// amp LFO or a closing filter can dip it briefly while the note continues.
+	bool	isInaudible		(float threshold) const { return mAmpADSR.isReleased() && mEnvelopeLevel < threshold; }
 	void	triggerOn		(bool reset);
 	void	triggerOff		();
 	void	setVelocity		(float velocity);
@@ -55,11 +62,23 @@ public:
 	void	UpdateParameter		(Param, float);
 
 	void	ProcessSamplesMix	(float *buffer, int numSamples, float vol);
+	// Renders into separate left and right buffers, panned by setPan()
+	void	ProcessSamplesMix	(float *left, float *right, int numSamples, float vol);
+
+	// -1 (left) to +1 (right), for the stereo path only
+	void	setPan				(float pan);
 
 	void	SetSampleRate		(int);
 
+	// Runs the oscillators, mixer and filter at 1, 2 or 4 times the sample rate
+	void	setOversampling		(int factor);
+	float	getLatency			() const { return mOversamplerLeft.getLatency(); }
+
 private:
 
+	void	updateUnison		();
+	void	processSamples		(float *left, float *right, int numSamples, float vol);
+
 	ParamSmoother	mVolume{0.f};
 
 	Lerper			mFrequency;
@@ -89,6 +108,12 @@ private:
 	float			mOsc2Detune = 1;
 	float			mOsc2Pitch = 0;
 	bool			mOsc2Sync = false;
+
+	// unison section
+	UnisonOscillator osc1Unison, osc2Unison;
+	int				mUnisonVoices = 1;
+	float			mUnisonDetune = 0;
+	float			mUnisonSpread = 0;
 	
 	// filter section
 	float			mFilterEnvAmt = 0;
@@ -98,8 +123,9 @@ private:
 	float			mFilterKbdTrack = 0;
 	float			mFilterVelSens = 0;
 	SynthFilter 	filter;
-	SynthFilter::Type mFilterType;
-	SynthFilter::Slope mFilterSlope;
+	SynthFilter 	filterRight;
+	SynthFilter::Type mFilterType = SynthFilter::Type::kLowPass;
+	SynthFilter::Slope mFilterSlope = SynthFilter::Slope::k24;
 	ADSR 			mFilterADSR;
 	
 	// amp section
@@ -107,10 +133,19 @@ private:
 	SmoothedParam	mAmpModAmount{-1.f};
 	SmoothedParam	mAmpVelSens{1.f};
 	ADSR 			mAmpADSR;
+	float			mEnvelopeLevel = 0;
+	float			mPanGainLeft = 1;
+	float			mPanGainRight = 1;
+
+	int				mOversampling = 1;
+	Oversampler		mOversamplerLeft;
+	Oversampler		mOversamplerRight;
 
 	struct {
-		float osc_1[kMaxProcessBufferSize];
-		float osc_2[kMaxProcessBufferSize];
+		float osc_1[kMaxProcessBufferSize * Oversampler::kMaxFactor];
+		float osc_2[kMaxProcessBufferSize * Oversampler::kMaxFactor];
+		float osc_1_right[kMaxProcessBufferSize * Oversampler::kMaxFactor];
+		float osc_2_right[kMaxProcessBufferSize * Oversampler::kMaxFactor];
 		float lfo_osc_1[kMaxProcessBufferSize];
 		float filter_env[kMaxProcessBufferSize];
 		float amp_env[kMaxProcessBufferSize];
@@ -0,0 +1,106 @@
+/*
+ *  VoiceBudget.cpp
+ *
+ *  Copyright (c) 2023 Nick Dowell
+ *
+ *  This file is part of amsynth.
+ *
+ *  amsynth is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  amsynth is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with amsynth.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "VoiceBudget.h"
+
+#include "VoiceAllocationUnit.h"
+#include "core/Configuration.h"
+
+#include <algorithm>
+
+
+VoiceBudget &
+VoiceBudget::global()
+{
+	// Never destroyed, as instances may outlive static destructors
+	static VoiceBudget *budget = [] {
+		auto budget = new VoiceBudget;
+		budget->setMaxVoices(Configuration::get().voice_budget);
+		return budget;
+	}();
+	return *budget;
+}
+
+void
+VoiceBudget::addVoiceAllocationUnit		(VoiceAllocationUnit *unit)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (std::find(units.begin(), units.end(), unit) == units.end())
+		units.push_back(unit);
+}
+
+void
+VoiceBudget::removeVoiceAllocationUnit	(VoiceAllocationUnit *unit)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	units.erase(std::remove(units.begin(), units.end(), unit), units.end());
+}
+
+int
+VoiceBudget::countActiveVoices	()
+{
+	// Don't block the audio thread while units are being added or removed
+	std::unique_lock<std::mutex> lock(mutex, std::try_to_lock);
+	if (!lock.owns_lock())
+		return 0;
+	int count = 0;
+	for (auto unit : units)
+		count += unit->getBudgetedVoices();
+	return count;
+}
+
+bool
+VoiceBudget::isExhausted		()
+{
+	const int max = maxVoices;
+	return 0 < max && max <= countActiveVoices();
+}
+
+bool
+VoiceBudget::requestVoiceFrom	(VoiceAllocationUnit *requester)
+{
+	std::unique_lock<std::mutex> lock(mutex, std::try_to_lock);
+	if (!lock.owns_lock())
+		return false;
+
+	VoiceAllocationUnit *victim = nullptr;
+	int victimPriority = 0;
+	float victimLevel = 0;
+	for (auto unit : units) {
+		const int voices = unit->getBudgetedVoices();
+		if (voices <= 0 || voices <= unit->getReservedVoices())
+			continue;
+		const int priority = unit->getVoicePriority();
+		const float level = unit->getStealCandidateLevel();
+		if (!victim || priority < victimPriority || (priority == victimPriority && level < victimLevel)) {
+			victim = unit;
+			victimPriority = priority;
+			victimLevel = level;
+		}
+	}
+
+	// A part may not take voices from a more important one
+	if (!victim || victim == requester || victimPriority > requester->getVoicePriority())
+		return false;
+
+	victim->requestStealVoice();
+	return true;
+}
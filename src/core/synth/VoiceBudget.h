@@ -0,0 +1,71 @@
+/*
+ *  VoiceBudget.h
+ *
+ *  Copyright (c) 2023 Nick Dowell
+ *
+ *  This file is part of amsynth.
+ *
+ *  amsynth is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  amsynth is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with amsynth.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _VOICEBUDGET_H
+#define _VOICEBUDGET_H
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+class VoiceAllocationUnit;
+
+/*
+ * Limits the total number of voices playing across several
+ * VoiceAllocationUnits, e.g. the parts of a multitimbral synthesizer or all
+ * the plugin instances in a process.
+ *
+ * When the budget is exhausted the unit with the lowest priority that is
+ * playing more than its reserved voices gives one up, preferring the unit
+ * whose candidate voice is quietest. Units may run on different threads, so
+ * a unit that takes a voice from another only asks for it to be freed; the
+ * victim releases it at the start of its next block.
+ */
+class VoiceBudget
+{
+public:
+	// The budget shared by all Synthesizer instances in the process, limited
+	// by the voice_budget configuration setting
+	static VoiceBudget & global();
+
+	void	setMaxVoices	(int voices) { maxVoices = voices; }
+	int		getMaxVoices	() const { return maxVoices; }
+
+	// Must not be called from the audio thread
+	void	addVoiceAllocationUnit		(VoiceAllocationUnit *);
+	void	removeVoiceAllocationUnit	(VoiceAllocationUnit *);
+
+	int		countActiveVoices	();
+	bool	isExhausted			();
+
+	// Asks the unit that should give up a voice so that requester can play a
+	// new one to free it. Returns false if no other unit was asked, e.g.
+	// because every other unit is within its reservation. The request is made
+	// while the unit list is locked, so the victim cannot be removed meanwhile.
+	bool	requestVoiceFrom	(VoiceAllocationUnit *requester);
+
+private:
+	std::atomic<int> maxVoices {0}; // 0 means unlimited
+	std::mutex mutex;
+	std::vector<VoiceAllocationUnit *> units;
+};
+
+#endif
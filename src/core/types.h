@@ -34,6 +34,13 @@ struct amsynth_midi_event_t {
 	unsigned char *buffer;
 };
 
+// A parameter change to apply at a given frame within a process() call
+struct amsynth_parameter_event_t {
+	unsigned int offset_frames;
+	int parameter;
+	float value;
+};
+
 struct amsynth_midi_cc_t {
 	unsigned char channel;
 	unsigned char cc;
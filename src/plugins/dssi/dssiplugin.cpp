@@ -32,6 +32,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <vector>
 
 
 #ifdef DEBUG
@@ -47,11 +48,15 @@ static DSSI_Descriptor *	s_dssiDescriptor   = nullptr;
 static PresetController *	s_presetController = nullptr;
 static unsigned long 		s_lastBankGet = ULONG_MAX;
 
-#define MIDI_BUFFER_SIZE 4096
+// Preallocated event capacity; a larger block grows the buffers once
+#define MIDI_EVENTS_RESERVED 1024
 
 struct amsynth_wrapper {
 	Synthesizer *synth;
-	unsigned char *midi_buffer;
+	std::vector<unsigned char> midi_buffer; // 3 bytes per event
+	std::vector<amsynth_midi_event_t> midi_events;
+	std::vector<amsynth_midi_cc_t> midi_out;
+	LADSPA_Data run_adding_gain;
 	LADSPA_Data *out_l;
 	LADSPA_Data *out_r;
 	LADSPA_Data **params;
@@ -92,7 +97,9 @@ static LADSPA_Handle instantiate (const LADSPA_Descriptor * descriptor, unsigned
     amsynth_wrapper * a = new amsynth_wrapper;
     a->synth = new Synthesizer;
     a->synth->setSampleRate(s_rate);
-    a->midi_buffer = (unsigned char *)calloc(MIDI_BUFFER_SIZE, 1);
+    a->midi_buffer.resize(MIDI_EVENTS_RESERVED * 3);
+    a->midi_events.reserve(MIDI_EVENTS_RESERVED);
+    a->run_adding_gain = 1.0f;
     a->params = (LADSPA_Data **) calloc (kAmsynthParameterCount, sizeof (LADSPA_Data *));
     return (LADSPA_Handle) a;
 }
@@ -102,7 +109,6 @@ static void cleanup (LADSPA_Handle instance)
 	TRACE();
     amsynth_wrapper * a = (amsynth_wrapper *) instance;
     delete a->synth;
-    free (a->midi_buffer);
     free (a->params);
     delete a;
 }
@@ -145,11 +151,12 @@ static void select_program(LADSPA_Handle Instance, unsigned long Bank, unsigned
 
 	TRACE_ARGS("Bank = %d Index = %d", Bank, Index);
 
-	const std::vector<BankInfo> &banks = PresetController::getPresetBanks();
+	// called from run_synth, so must be realtime safe
+	PresetController *presetController = a->synth->getPresetController();
 
-	if (Bank < banks.size() && Index < PresetController::kNumPresets) {
-		s_presetController->loadPresets(banks[Bank].file_path.c_str());
-		a->synth->setPresetNumber(Index);
+	// selectBank checks Bank against the bank list itself, under try_lock
+	if (Bank <= INT_MAX && Index < PresetController::kNumPresets && presetController->selectBank((int) Bank)) {
+		presetController->selectPresetRealtime((int) Index);
 		// now update DSSI host's view of the parameters
 		for (unsigned i = 0; i < kAmsynthParameterCount; i++) {
 			float value = a->synth->getParameterValue((Param)i);
@@ -177,21 +184,24 @@ static void connect_port (LADSPA_Handle instance, unsigned long port, LADSPA_Dat
 
 //////////////////// Audio callback ////////////////////////////////////////////
 
-static void run_synth (LADSPA_Handle instance, unsigned long sample_count, snd_seq_event_t *events, unsigned long event_count)
+// Converts the ALSA sequencer events into MIDI messages in the instance's
+// preallocated buffers, and applies changed parameter ports
+static void decode_events (amsynth_wrapper *a, snd_seq_event_t *events, unsigned long event_count)
 {
-	amsynth_wrapper * a = (amsynth_wrapper *) instance;
-
-	memset(a->midi_buffer, 0, MIDI_BUFFER_SIZE);
-	unsigned char *midi_buffer_ptr = a->midi_buffer;
+	if (a->midi_buffer.size() < event_count * 3) {
+		a->midi_buffer.resize(event_count * 3);
+		a->midi_events.reserve(event_count);
+	}
+	a->midi_events.clear();
+	unsigned char *midi_buffer_ptr = a->midi_buffer.data();
 
 #define push_midi_ev3(__status__, __byte1__, __byte2__) do { \
 	midi_buffer_ptr[0] = __status__; \
 	midi_buffer_ptr[1] = __byte1__; \
 	midi_buffer_ptr[2] = __byte2__; \
-	midi_events.push_back((amsynth_midi_event_t){ e->time.tick, 3, midi_buffer_ptr }); \
+	a->midi_events.push_back((amsynth_midi_event_t){ e->time.tick, 3, midi_buffer_ptr }); \
 	midi_buffer_ptr += 3; } while (0)
 
-	std::vector<amsynth_midi_event_t> midi_events;
 	for (snd_seq_event_t *e = events; e < events + event_count; e++) {
 		switch (e->type) {
 		case SND_SEQ_EVENT_NOTEON:
@@ -213,12 +223,13 @@ static void run_synth (LADSPA_Handle instance, unsigned long sample_count, snd_s
 			break;
 		}
 		case SND_SEQ_EVENT_PGMCHANGE:
-			select_program(instance, 0, e->data.control.value);
+			select_program((LADSPA_Handle) a, 0, e->data.control.value);
 			break;
 		default:
 			break;
 		}
 	}
+#undef push_midi_ev3
 
 	for (unsigned i = (Param)0; i < kAmsynthParameterCount; i++) {
 		const LADSPA_Data host_value = *(a->params[i]);
@@ -226,9 +237,45 @@ static void run_synth (LADSPA_Handle instance, unsigned long sample_count, snd_s
 			a->synth->setParameterValue((Param)i, host_value);
 		}
 	}
+}
 
-	std::vector<amsynth_midi_cc_t> midi_out;
-	a->synth->process(sample_count, midi_events, midi_out, a->out_l, a->out_r);
+static void render (amsynth_wrapper *a, unsigned long sample_count, bool adding)
+{
+	a->midi_out.clear();
+	a->synth->setAccumulate(adding, a->run_adding_gain);
+	a->synth->process(sample_count, a->midi_events, a->midi_out, a->out_l, a->out_r);
+}
+
+static void run_synth (LADSPA_Handle instance, unsigned long sample_count, snd_seq_event_t *events, unsigned long event_count)
+{
+	amsynth_wrapper * a = (amsynth_wrapper *) instance;
+	decode_events(a, events, event_count);
+	render(a, sample_count, false);
+}
+
+static void run_synth_adding (LADSPA_Handle instance, unsigned long sample_count, snd_seq_event_t *events, unsigned long event_count)
+{
+	amsynth_wrapper * a = (amsynth_wrapper *) instance;
+	decode_events(a, events, event_count);
+	render(a, sample_count, true);
+}
+
+// Decodes the events for every instance first, so the per-instance setup is
+// done in one pass and the instances are then rendered back to back.
+static void run_multiple_synths (unsigned long instance_count, LADSPA_Handle *instances, unsigned long sample_count, snd_seq_event_t **events, unsigned long *event_counts)
+{
+	for (unsigned long i = 0; i < instance_count; i++)
+		decode_events((amsynth_wrapper *) instances[i], events[i], event_counts[i]);
+	for (unsigned long i = 0; i < instance_count; i++)
+		render((amsynth_wrapper *) instances[i], sample_count, false);
+}
+
+static void run_multiple_synths_adding (unsigned long instance_count, LADSPA_Handle *instances, unsigned long sample_count, snd_seq_event_t **events, unsigned long *event_counts)
+{
+	for (unsigned long i = 0; i < instance_count; i++)
+		decode_events((amsynth_wrapper *) instances[i], events[i], event_counts[i]);
+	for (unsigned long i = 0; i < instance_count; i++)
+		render((amsynth_wrapper *) instances[i], sample_count, true);
 }
 
 // renoise ignores DSSI plugins that don't implement run
@@ -238,6 +285,16 @@ static void run (LADSPA_Handle instance, unsigned long sample_count)
     run_synth (instance, sample_count, nullptr, 0);
 }
 
+static void run_adding (LADSPA_Handle instance, unsigned long sample_count)
+{
+    run_synth_adding (instance, sample_count, nullptr, 0);
+}
+
+static void set_run_adding_gain (LADSPA_Handle instance, LADSPA_Data gain)
+{
+    ((amsynth_wrapper *) instance)->run_adding_gain = gain;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 /*
@@ -326,8 +383,8 @@ static void __attribute__ ((constructor)) my_init ()
 
 		s_ladspaDescriptor->connect_port = connect_port;
 		s_ladspaDescriptor->run = run;
-		s_ladspaDescriptor->run_adding = nullptr;
-		s_ladspaDescriptor->set_run_adding_gain = nullptr;
+		s_ladspaDescriptor->run_adding = run_adding;
+		s_ladspaDescriptor->set_run_adding_gain = set_run_adding_gain;
     }
 
 	/* DSSI descriptor */
@@ -341,9 +398,9 @@ static void __attribute__ ((constructor)) my_init ()
 		s_dssiDescriptor->get_midi_controller_for_port	= nullptr;
 		s_dssiDescriptor->select_program 				= select_program;
 		s_dssiDescriptor->run_synth 					= run_synth;
-		s_dssiDescriptor->run_synth_adding 				= nullptr;
-		s_dssiDescriptor->run_multiple_synths 			= nullptr;
-		s_dssiDescriptor->run_multiple_synths_adding	= nullptr;
+		s_dssiDescriptor->run_synth_adding 				= run_synth_adding;
+		s_dssiDescriptor->run_multiple_synths 			= run_multiple_synths;
+		s_dssiDescriptor->run_multiple_synths_adding	= run_multiple_synths_adding;
     }
 }
 
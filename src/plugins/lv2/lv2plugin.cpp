@@ -25,7 +25,8 @@
 #include "core/synth/Synthesizer.h"
 
 #include <cstdio>
-#include <map>
+#include <cstdlib>
+#include <cstring>
 #include <string>
 
 #ifdef DEBUG
@@ -34,6 +35,25 @@
 #define LOG_FUNCTION_CALL()
 #endif
 
+enum {
+#define DECLARE_PROPERTY_INDEX(Name) kProperty_##Name,
+	FOR_EACH_PROPERTY(DECLARE_PROPERTY_INDEX)
+	kPropertyCount
+};
+
+static const char *const kPropertyNames[] = {
+#define DECLARE_PROPERTY_NAME(Name) #Name,
+	FOR_EACH_PROPERTY(DECLARE_PROPERTY_NAME)
+};
+
+static const size_t kMaxPropertyLength = 1024;
+
+// Passed from the worker to the audio thread once a property has been loaded
+struct amsynth_property_change {
+	int property;
+	char value[kMaxPropertyLength];
+};
+
 struct amsynth_wrapper {
 	amsynth_wrapper() : schedule(nullptr), control_port(nullptr), out_l(nullptr), out_r(nullptr) {}
 
@@ -46,8 +66,11 @@ struct amsynth_wrapper {
 		LV2_URID patch_property;
 		LV2_URID patch_value;
 		LV2_URID atom_String;
-#define DECLARE_LV2_URID(name) LV2_URID amsynth_##name;
-		FOR_EACH_PROPERTY(DECLARE_LV2_URID)
+		LV2_URID atom_Float;
+		LV2_URID atom_Double;
+		LV2_URID atom_Int;
+		LV2_URID parameters[kAmsynthParameterCount];
+		LV2_URID properties[kPropertyCount];
 	} uris;
 
 	LV2_Atom_Forge forge;
@@ -57,15 +80,93 @@ struct amsynth_wrapper {
     LV2_Atom_Sequence *notify_port {nullptr};
 	float *out_l;
 	float *out_r;
+	float *latency_port {nullptr};
 	float *param_ports[kAmsynthParameterCount];
 
-	std::map<LV2_URID, std::string> patch_values;
+	// Port values seen in the previous run, so that only the ports the host
+	// has changed are applied. Unconnected ports keep the synth's value.
+	float param_values[kAmsynthParameterCount];
+	std::vector<amsynth_parameter_event_t> param_events;
+
+	// Property values are only written on the audio thread (or in restore,
+	// which the host does not call concurrently with run) so that patch:Get
+	// can be answered without locking or allocating.
+	char property_values[kPropertyCount][kMaxPropertyLength];
+
+	std::vector<amsynth_midi_event_t> midi_events;
+	std::vector<amsynth_midi_cc_t> midi_out;
+
+	int propertyIndex(LV2_URID urid) const
+	{
+		for (int i = 0; i < kPropertyCount; i++)
+			if (uris.properties[i] == urid)
+				return i;
+		return -1;
+	}
+
+	// Called from the worker: does any slow work (e.g. parsing tuning files)
+	// and fills in the change for applyProperty. Returns false if the
+	// property or value is not accepted.
+	bool prepareProperty(LV2_URID urid, const char *value, amsynth_property_change &change)
+	{
+		change.property = propertyIndex(urid);
+		if (change.property < 0)
+			return false;
+		if (strlen(value) >= kMaxPropertyLength) {
+			fprintf(stderr, "amsynth: %s value is too long\n", kPropertyNames[change.property]);
+			return false;
+		}
+		strcpy(change.value, value);
+		switch (change.property) {
+			case kProperty_max_polyphony:
+			case kProperty_midi_channel:
+			case kProperty_pitch_bend_range:
+				break; // applied on the audio thread
+			default:
+				synth.setProperty(kPropertyNames[change.property], value);
+				break;
+		}
+		return true;
+	}
+
+	// Called from the audio thread
+	void applyProperty(const amsynth_property_change &change)
+	{
+		strcpy(property_values[change.property], change.value);
+		switch (change.property) {
+			case kProperty_max_polyphony:    synth.setMaxNumVoices(atoi(change.value)); break;
+			case kProperty_midi_channel:     synth.setMidiChannel((unsigned char)atoi(change.value)); break;
+			case kProperty_pitch_bend_range: synth.setPitchBendRangeSemitones(atoi(change.value)); break;
+			default: break;
+		}
+	}
 
-	void patchSet(LV2_URID urid, const char *value)
+	// Queues a patch:Set of a numeric parameter value so that it is applied
+	// at the message's frame time. Returns false for other properties.
+	// param_events must have room for another event.
+	bool parameterSet(const LV2_Atom_Object *obj, int64_t frames)
 	{
-		patch_values[urid] = (std::string) value;
-#define PATCH_SET_PROP(Name) if (urid == uris.amsynth_##Name) synth.setProperty(#Name, value);
-		FOR_EACH_PROPERTY(PATCH_SET_PROP)
+		const LV2_Atom_URID *property = nullptr;
+		const LV2_Atom *value = nullptr;
+		lv2_atom_object_get(obj, uris.patch_property, &property, uris.patch_value, &value, 0);
+		if (!property || !value)
+			return false;
+		for (int i = 0; i < kAmsynthParameterCount; i++) {
+			if (property->body != uris.parameters[i])
+				continue;
+			float number;
+			if (value->type == uris.atom_Float)
+				number = ((const LV2_Atom_Float *)value)->body;
+			else if (value->type == uris.atom_Double)
+				number = (float)((const LV2_Atom_Double *)value)->body;
+			else if (value->type == uris.atom_Int)
+				number = (float)((const LV2_Atom_Int *)value)->body;
+			else
+				return true; // not a number, ignore
+			param_events.push_back({static_cast<unsigned>(frames), i, number});
+			return true;
+		}
+		return false;
 	}
 };
 
@@ -77,18 +178,37 @@ lv2_instantiate(const LV2_Descriptor *, double sample_rate, const char */*bundle
 	amsynth_wrapper *a = new amsynth_wrapper;
 
 	LV2_URID_Map *urid_map = nullptr;
+	const LV2_Options_Option *options = nullptr;
 	for (auto f = features; *f; f++) {
 		if (!strcmp((*f)->URI, LV2_URID__map))
 			urid_map = reinterpret_cast<LV2_URID_Map *>((*f)->data);
 		if (!strcmp((*f)->URI, LV2_WORKER__schedule))
 			a->schedule = reinterpret_cast<LV2_Worker_Schedule *>((*f)->data);
+		if (!strcmp((*f)->URI, LV2_OPTIONS__options))
+			options = reinterpret_cast<const LV2_Options_Option *>((*f)->data);
 	}
 	if (!urid_map) {
 		delete a;
 		return nullptr;
 	}
 
-	a->synth.setSampleRate((int)sample_rate);
+	unsigned max_block_length = 4096;
+	if (options) {
+		const LV2_URID maxBlockLength = urid_map->map(urid_map->handle, LV2_BUF_SIZE__maxBlockLength);
+		const LV2_URID atom_Int = urid_map->map(urid_map->handle, LV2_ATOM__Int);
+		for (auto o = options; o->key; o++) {
+			if (o->key == maxBlockLength && o->type == atom_Int && *(const int32_t *)o->value > 0)
+				max_block_length = (unsigned)*(const int32_t *)o->value;
+		}
+	}
+
+	a->synth.prepare((int)sample_rate, max_block_length);
+
+	for (unsigned i=0; i<kAmsynthParameterCount; i++) {
+		a->param_ports[i] = nullptr;
+		a->param_values[i] = a->synth.getParameterValue((Param)i);
+	}
+	a->param_events.reserve(kAmsynthParameterCount + 256);
 
 	a->uris.midiEvent          = urid_map->map(urid_map->handle, LV2_MIDI__MidiEvent);
 	a->uris.patch_Get          = urid_map->map(urid_map->handle, LV2_PATCH__Get);
@@ -96,12 +216,25 @@ lv2_instantiate(const LV2_Descriptor *, double sample_rate, const char */*bundle
 	a->uris.patch_property     = urid_map->map(urid_map->handle, LV2_PATCH__property);
 	a->uris.patch_value        = urid_map->map(urid_map->handle, LV2_PATCH__value);
 	a->uris.atom_String        = urid_map->map(urid_map->handle, LV2_ATOM__String);
-#define MAP_URID(Name) a->uris.amsynth_##Name = urid_map->map(urid_map->handle, AMSYNTH_LV2_URI "#" #Name);
+	a->uris.atom_Float         = urid_map->map(urid_map->handle, LV2_ATOM__Float);
+	a->uris.atom_Double        = urid_map->map(urid_map->handle, LV2_ATOM__Double);
+	a->uris.atom_Int           = urid_map->map(urid_map->handle, LV2_ATOM__Int);
+	for (int i = 0; i < kAmsynthParameterCount; i++) {
+		std::string uri = std::string(AMSYNTH_LV2_URI "#") + parameter_name_from_index(i);
+		a->uris.parameters[i] = urid_map->map(urid_map->handle, uri.c_str());
+	}
+#define MAP_URID(Name) a->uris.properties[kProperty_##Name] = urid_map->map(urid_map->handle, AMSYNTH_LV2_URI "#" #Name);
 	FOR_EACH_PROPERTY(MAP_URID)
 
 	auto properties = a->synth.getProperties();
-#define GET_PATCH_VALUE(Name) a->patch_values[a->uris.amsynth_##Name] = properties[#Name];
-	FOR_EACH_PROPERTY(GET_PATCH_VALUE)
+	for (int i = 0; i < kPropertyCount; i++) {
+		const std::string &value = properties[kPropertyNames[i]];
+		strncpy(a->property_values[i], value.c_str(), kMaxPropertyLength - 1);
+		a->property_values[i][kMaxPropertyLength - 1] = '\0';
+	}
+
+	a->midi_events.reserve(1024);
+	a->midi_out.reserve(1024);
 
 	lv2_atom_forge_init(&a->forge, urid_map);
 
@@ -133,6 +266,9 @@ lv2_connect_port(LV2_Handle instance, uint32_t port, void *data_location)
 		case PORT_AUDIO_R:
 			a->out_r = (float *) data_location;
 			break;
+		case PORT_LATENCY:
+			a->latency_port = (float *) data_location;
+			break;
 		default:
 			if (PORT_FIRST_PARAMETER <= port && (port - PORT_FIRST_PARAMETER) < kAmsynthParameterCount) {
 				a->param_ports[port - PORT_FIRST_PARAMETER] = (float *) data_location;
@@ -167,11 +303,46 @@ lv2_run(LV2_Handle instance, uint32_t sample_count)
     LV2_Atom_Forge_Frame notify_frame;
     lv2_atom_forge_sequence_head(forge, &notify_frame, 0);
 
-    std::vector<amsynth_midi_event_t> midi_events;
+	// Gather the port values into a contiguous array so that the comparison
+	// with the previous run is a single vectorisable pass, and only walk the
+	// parameters when something has actually changed. Port changes go at the
+	// start of the buffer, ahead of any timestamped patch:Set messages.
+	float host_values[kAmsynthParameterCount];
+	for (unsigned i=0; i<kAmsynthParameterCount; i++) {
+		host_values[i] = a->param_ports[i] ? *a->param_ports[i] : a->param_values[i];
+	}
+	int changed = 0;
+	for (unsigned i=0; i<kAmsynthParameterCount; i++) {
+		changed |= host_values[i] != a->param_values[i];
+	}
+	a->param_events.clear();
+	if (changed) {
+		for (unsigned i=0; i<kAmsynthParameterCount; i++) {
+			if (a->param_ports[i] && host_values[i] != a->param_values[i]) {
+				a->param_events.push_back({0, (int)i, host_values[i]});
+				a->param_values[i] = host_values[i];
+			}
+		}
+	}
+
+	std::vector<amsynth_midi_event_t> &midi_events = a->midi_events;
+	midi_events.clear();
+	a->midi_out.clear();
+
+	// Renders the frames up to `frame` with the events gathered so far. Used
+	// to make room when param_events is full, as growing it would allocate.
+	uint32_t rendered = 0;
+	auto render = [&](uint32_t frame) {
+		a->synth.process(frame - rendered, midi_events, a->param_events, a->midi_out, a->out_l + rendered, a->out_r + rendered);
+		midi_events.clear();
+		a->param_events.clear();
+		rendered = frame;
+	};
+
 	LV2_ATOM_SEQUENCE_FOREACH(a->control_port, ev) {
 		if (ev->body.type == a->uris.midiEvent) {
 			amsynth_midi_event_t midi_event {};
-			midi_event.offset_frames = static_cast<unsigned>(ev->time.frames);
+			midi_event.offset_frames = static_cast<unsigned>(ev->time.frames) - rendered;
 			midi_event.buffer = (uint8_t *)(ev + 1);
 			midi_event.length = ev->body.size;
 			midi_events.push_back(midi_event);
@@ -185,36 +356,37 @@ lv2_run(LV2_Handle instance, uint32_t sample_count)
 				if (!property)
 					continue;
 				const LV2_URID key = property->body;
-				auto it = a->patch_values.find(key);
-				if (it == a->patch_values.end())
+				const int index = a->propertyIndex(key);
+				if (index < 0)
 					continue;
+				const char *value = a->property_values[index];
 				lv2_atom_forge_frame_time(forge, ev->time.frames);
 				LV2_Atom_Forge_Frame frame;
 				lv2_atom_forge_object(forge, &frame, 0, a->uris.patch_Set);
 				lv2_atom_forge_key(forge, a->uris.patch_property);
 				lv2_atom_forge_urid(forge, key);
 				lv2_atom_forge_key(forge, a->uris.patch_value);
-				lv2_atom_forge_string(forge, it->second.c_str(), static_cast<uint32_t>(it->second.size()));
+				lv2_atom_forge_string(forge, value, static_cast<uint32_t>(strlen(value)));
 				lv2_atom_forge_pop(forge, &frame);
 			}
 			if (obj->body.otype == a->uris.patch_Set) {
-                // Note: some property types could be handled here without using worker
+				if (a->param_events.size() == a->param_events.capacity())
+					render(static_cast<uint32_t>(ev->time.frames));
+				if (a->parameterSet(obj, ev->time.frames - rendered))
+					continue;
+			}
+			if (obj->body.otype == a->uris.patch_Set && a->schedule) {
+				// Loading the value may be slow, so it happens in the worker
+				// and is then applied in work_response
 				a->schedule->schedule_work(a->schedule->handle, lv2_atom_total_size(&ev->body), &ev->body);
 			}
 		}
 	}
 
-	for (unsigned i=0; i<kAmsynthParameterCount; i++) {
-		const float *host_value = a->param_ports[i];
-		if (host_value != nullptr) {
-			if (a->synth.getParameterValue((Param)i) != *host_value) {
-				a->synth.setParameterValue((Param)i, *host_value);
-			}
-		}
-	}
+	render(sample_count);
 
-	std::vector<amsynth_midi_cc_t> midi_out;
-	a->synth.process(sample_count, midi_events, midi_out, a->out_l, a->out_r);
+	if (a->latency_port)
+		*a->latency_port = (float)a->synth.getLatency();
 }
 
 static LV2_State_Status
@@ -230,11 +402,11 @@ save(LV2_Handle                instance,
 
 	// host takes care of saving port values
 
-	std::map<LV2_URID, std::string>::const_iterator it;
-	for (it = a->patch_values.begin(); it != a->patch_values.end(); ++it) {
-		if (!it->second.length())
+	for (int i = 0; i < kPropertyCount; i++) {
+		const char *value = a->property_values[i];
+		if (!strlen(value))
 			continue;
-		store(handle, it->first, it->second.c_str(), it->second.length() + 1,
+		store(handle, a->uris.properties[i], value, strlen(value) + 1,
 			  a->uris.atom_String, LV2_STATE_IS_POD | LV2_STATE_IS_PORTABLE);
 	}
 
@@ -254,24 +426,25 @@ restore(LV2_Handle                  instance,
 
 	// host takes care of restoring port values
 
-	auto restoreProp = [=] (LV2_URID urid) {
+	// restore is not called concurrently with run, so the change can be
+	// applied directly rather than via the worker
+
+	for (int i = 0; i < kPropertyCount; i++) {
 		size_t size = 0; uint32_t type = 0, vflags = 0;
-		const void *value = retrieve(handle, urid, &size, &type, &vflags);
-		if (value && type == a->uris.atom_String) {
-			a->patchSet(urid, (const char *)value);
+		const void *value = retrieve(handle, a->uris.properties[i], &size, &type, &vflags);
+		amsynth_property_change change;
+		if (value && type == a->uris.atom_String && a->prepareProperty(a->uris.properties[i], (const char *)value, change)) {
+			a->applyProperty(change);
 		}
-	};
-
-#define RESTORE_PROP(name) restoreProp(a->uris.amsynth_##name);
-	FOR_EACH_PROPERTY(RESTORE_PROP)
+	}
 
 	return LV2_STATE_SUCCESS;
 }
 
 static LV2_Worker_Status
 work(LV2_Handle                  instance,
-	 LV2_Worker_Respond_Function /*respond*/,
-	 LV2_Worker_Respond_Handle   /*handle*/,
+	 LV2_Worker_Respond_Function respond,
+	 LV2_Worker_Respond_Handle   handle,
 	 uint32_t                    /*size*/,
 	 const void*                 data)
 {
@@ -287,22 +460,46 @@ work(LV2_Handle                  instance,
 							a->uris.patch_property, &property,
 							a->uris.patch_value, &value,
 							0);
-		a->patchSet(((LV2_Atom_URID *) (void *) property)->body, (const char *) LV2_ATOM_BODY_CONST(value));
+		if (!property || !value || value->type != a->uris.atom_String)
+			return LV2_WORKER_ERR_UNKNOWN;
+		amsynth_property_change change;
+		if (a->prepareProperty(((LV2_Atom_URID *) (void *) property)->body, (const char *) LV2_ATOM_BODY_CONST(value), change))
+			return respond(handle, sizeof(change), &change);
 	}
 
 	return LV2_WORKER_SUCCESS;
 }
 
 static LV2_Worker_Status
-work_response(LV2_Handle  /*instance*/,
-			  uint32_t    /*size*/,
-			  const void* /*data*/)
+work_response(LV2_Handle  instance,
+			  uint32_t    size,
+			  const void* data)
 {
 	LOG_FUNCTION_CALL();
 
+	amsynth_wrapper * a = (amsynth_wrapper *) instance;
+
+	if (size != sizeof(amsynth_property_change))
+		return LV2_WORKER_ERR_UNKNOWN;
+
+	a->applyProperty(*(const amsynth_property_change *) data);
+
 	return LV2_WORKER_SUCCESS;
 }
 
+static void
+get_status(LV2_Handle instance, amsynth_lv2_status *status)
+{
+	amsynth_wrapper * a = (amsynth_wrapper *) instance;
+
+	SynthStatus &synthStatus = a->synth.getStatus();
+	status->peak_left = SynthStatus::takePeak(synthStatus.peakLeft);
+	status->peak_right = SynthStatus::takePeak(synthStatus.peakRight);
+	status->active_voices = synthStatus.activeVoices.load(std::memory_order_relaxed);
+	status->dsp_load = synthStatus.dspLoad.load(std::memory_order_relaxed);
+	status->preset_modified = synthStatus.presetModified.load(std::memory_order_relaxed);
+}
+
 static const void *
 lv2_extension_data(const char *uri)
 {
@@ -318,6 +515,11 @@ lv2_extension_data(const char *uri)
 		return &worker;
 	}
 
+	if (strcmp(uri, AMSYNTH_LV2_STATUS_URI) == 0) {
+		static const amsynth_lv2_status_interface status = { get_status };
+		return &status;
+	}
+
 	return nullptr;
 }
 
@@ -22,9 +22,13 @@
 #ifndef AMSYNTH_LV2_H
 #define AMSYNTH_LV2_H
 
+#include "core/controls.h"
+
 #include "lv2/atom/atom.h"
 #include "lv2/atom/forge.h"
+#include "lv2/buf-size/buf-size.h"
 #include "lv2/midi/midi.h"
+#include "lv2/options/options.h"
 #include "lv2/patch/patch.h"
 #include "lv2/state/state.h"
 #include "lv2/ui/ui.h"
@@ -43,12 +47,32 @@
 	X(tuning_scl_file) \
 	X(tuning_mts_esp_disabled)
 
+/*
+ * Extension data for hosts that want to show meters without instantiating
+ * the UI. get_status only reads a few atomics and may be called from any
+ * thread, including while run() is in progress.
+ */
+#define AMSYNTH_LV2_STATUS_URI      AMSYNTH_LV2_URI "#status"
+
+typedef struct {
+	float   peak_left;          // highest absolute sample since the previous call
+	float   peak_right;
+	int32_t active_voices;
+	float   dsp_load;           // fraction of the last buffer's duration spent rendering
+	int32_t preset_modified;
+} amsynth_lv2_status;
+
+typedef struct {
+	void (*get_status)(LV2_Handle instance, amsynth_lv2_status *status);
+} amsynth_lv2_status_interface;
+
 enum {
     PORT_CONTROL            = 0,
     PORT_NOTIFY             = 1,
     PORT_AUDIO_L            = 2,
     PORT_AUDIO_R            = 3,
     PORT_FIRST_PARAMETER    = 4,
+    PORT_LATENCY            = PORT_FIRST_PARAMETER + kAmsynthParameterCount,
 };
 
 #endif //AMSYNTH_LV2_H
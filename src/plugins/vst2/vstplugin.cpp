@@ -48,7 +48,8 @@
 #define effBeginLoadBank        75
 #define effFlagsProgramChunks   (1 << 5)
 
-#define MIDI_BUFFER_SIZE 4096
+// Enough for dense MIDI from most hosts; a larger block grows the buffers once
+#define MIDI_EVENTS_RESERVED 4096
 
 static char hostProductString[64] = "";
 
@@ -64,16 +65,17 @@ struct Plugin final : public Parameter::Observer
 	{
 		audioMaster = master;
 		synthesizer = new Synthesizer;
-		midiBuffer = (unsigned char *)malloc(MIDI_BUFFER_SIZE);
+		midiBuffer.resize(MIDI_EVENTS_RESERVED * 3);
+		midiEvents.reserve(MIDI_EVENTS_RESERVED);
 		for (int i = 0; i < kAmsynthParameterCount; i++)
 			audioMasterValues[i] = synthesizer->_presetController->getCurrentPreset().getParameter(i).getNormalisedValue();
 		synthesizer->_presetController->getCurrentPreset().addObserver(this);
+		setInitialDelay(synthesizer->getLatency());
 	}
 
 	~Plugin()
 	{ 
 		delete synthesizer;
-		free(midiBuffer);
 	}
 
 	void parameterDidChange(const Parameter &parameter)
@@ -84,11 +86,28 @@ struct Plugin final : public Parameter::Observer
 						audioMasterValues[parameter.getId()] = parameter.getNormalisedValue());
 	}
 
+	void prepare()
+	{
+		synthesizer->prepare(sampleRate, blockSize);
+		int32_t latency = synthesizer->getLatency();
+		if (latency != getInitialDelay()) {
+			setInitialDelay(latency);
+			if (audioMaster)
+				audioMaster(effect, audioMasterIOChanged, 0, 0, nullptr, 0);
+		}
+	}
+
+	// vestige leaves initialDelay unnamed; it is the first field of empty3
+	int32_t getInitialDelay() const { int32_t value; memcpy(&value, effect->empty3, sizeof(value)); return value; }
+	void setInitialDelay(int32_t value) { memcpy(effect->empty3, &value, sizeof(value)); }
+
 	AEffect *effect;
 	audioMasterCallback audioMaster;
+	int sampleRate = 44100;
+	int blockSize = 4096;
 	std::vector<float> audioMasterValues;
 	Synthesizer *synthesizer;
-	unsigned char *midiBuffer;
+	std::vector<unsigned char> midiBuffer; // 3 bytes per event
 	std::vector<amsynth_midi_event_t> midiEvents;
 	std::string chunk;
 	JuceIntegration juceIntegration;
@@ -127,10 +146,15 @@ static intptr_t dispatcher(AEffect *effect, int opcode, int index, intptr_t val,
 			return 0;
 
 		case effSetSampleRate:
-			plugin->synthesizer->setSampleRate(f);
+			plugin->sampleRate = (int)f;
+			plugin->prepare();
 			return 0;
 
 		case effSetBlockSize:
+			plugin->blockSize = (int)val;
+			plugin->prepare();
+			return 0;
+
 		case effMainsChanged:
 			return 0;
 
@@ -152,6 +176,7 @@ static intptr_t dispatcher(AEffect *effect, int opcode, int index, intptr_t val,
 			if (!plugin->gui) {
 				plugin->gui = std::make_unique<MainComponent>(plugin->synthesizer->_presetController);
 			}
+			plugin->gui->setStatus(&plugin->synthesizer->getStatus());
 			for (const auto &it : plugin->synthesizer->getProperties()) {
 				plugin->gui->propertyChanged(it.first.c_str(), it.second.c_str());
 			}
@@ -185,10 +210,17 @@ static intptr_t dispatcher(AEffect *effect, int opcode, int index, intptr_t val,
 		case effProcessEvents: {
 			VstEvents *events = (VstEvents *)ptr;
 
+			// VST 2.4 does not say how long the host's event memory stays valid,
+			// so the message bytes are copied. Each channel message is at most
+			// 3 bytes, so sizing the buffer for the event count means nothing
+			// is dropped, and the buffers are only ever grown, not cleared.
 			plugin->midiEvents.clear();
-			memset(plugin->midiBuffer, 0, MIDI_BUFFER_SIZE);
+			if (plugin->midiBuffer.size() < (size_t)events->numEvents * 3) {
+				plugin->midiBuffer.resize(events->numEvents * 3);
+				plugin->midiEvents.reserve(events->numEvents);
+			}
 			size_t bytesCopied = 0;
-			
+
 			for (int32_t i=0; i<events->numEvents; i++) {
 #ifdef __GNUC__
 #pragma GCC diagnostic push
@@ -224,15 +256,10 @@ static intptr_t dispatcher(AEffect *effect, int opcode, int index, intptr_t val,
 					continue; // Ignore
 				}
 
-				if (bytesCopied + msgLength > MIDI_BUFFER_SIZE) {
-					fprintf(stderr, "amsynth: midi buffer overflow\n");
-					break;
-				}
-
 				amsynth_midi_event_t midi_event;
 				midi_event.offset_frames = event->deltaSamples;
 				midi_event.length = msgLength;
-				midi_event.buffer = (unsigned char *)memcpy(plugin->midiBuffer + bytesCopied, msgData, msgLength);
+				midi_event.buffer = (unsigned char *)memcpy(plugin->midiBuffer.data() + bytesCopied, msgData, msgLength);
 				plugin->midiEvents.push_back(midi_event);
 				bytesCopied += msgLength;
 			}
@@ -0,0 +1,300 @@
+/*
+ *  ControlServer.cpp
+ *
+ *  Copyright (c) 2023 Nick Dowell
+ *
+ *  This file is part of amsynth.
+ *
+ *  amsynth is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  amsynth is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with amsynth.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ControlServer.h"
+
+#include "core/controls.h"
+#include "core/synth/PresetController.h"
+#include "core/synth/Synthesizer.h"
+#include "core/synth/VoiceAllocationUnit.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <poll.h>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Longest command line accepted before the client is disconnected
+static const size_t kMaxLineLength = 4096;
+
+// Blocks in which a bank select is retried before it is given up
+static const unsigned kMaxSelectBankAttempts = 1000;
+
+ControlServer::ControlServer(const std::vector<Synthesizer *> &parts)
+:	parts(parts)
+,	pendingBanks(parts.size())
+{
+}
+
+ControlServer::~ControlServer()
+{
+	close();
+}
+
+int
+ControlServer::open(const std::string &path)
+{
+	struct sockaddr_un addr = {};
+	addr.sun_family = AF_UNIX;
+	if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "amsynth: invalid control socket path '%s'\n", path.c_str());
+		return -1;
+	}
+	strcpy(addr.sun_path, path.c_str());
+
+	if ((listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1) {
+		fprintf(stderr, "amsynth: could not create control socket: %s\n", strerror(errno));
+		return -1;
+	}
+	unlink(path.c_str());
+	if (bind(listenFd, (struct sockaddr *) &addr, sizeof(addr)) == -1 || listen(listenFd, 8) == -1) {
+		fprintf(stderr, "amsynth: could not listen on %s: %s\n", path.c_str(), strerror(errno));
+		::close(listenFd);
+		listenFd = -1;
+		return -1;
+	}
+	socketPath = path;
+	return 0;
+}
+
+void
+ControlServer::close()
+{
+	for (const Client &client : clients)
+		::close(client.fd);
+	clients.clear();
+	if (listenFd != -1) {
+		::close(listenFd);
+		listenFd = -1;
+		unlink(socketPath.c_str());
+	}
+}
+
+void
+ControlServer::poll(int timeout_ms)
+{
+	std::vector<struct pollfd> fds;
+	fds.push_back({listenFd, POLLIN, 0});
+	for (const Client &client : clients)
+		fds.push_back({client.fd, POLLIN, 0});
+
+	if (::poll(fds.data(), fds.size(), timeout_ms) <= 0)
+		return; // timed out, or interrupted by a signal
+
+	// Walk the clients backwards so that disconnected ones can be removed
+	for (size_t i = clients.size(); i-- > 0;) {
+		if (!fds[i + 1].revents)
+			continue;
+		Client &client = clients[i];
+		char buffer[1024];
+		ssize_t bytes = read(client.fd, buffer, sizeof(buffer));
+		bool disconnect = bytes <= 0;
+		if (bytes > 0)
+			client.input.append(buffer, (size_t) bytes);
+		size_t newline;
+		while (!disconnect && (newline = client.input.find('\n')) != std::string::npos) {
+			std::string reply = handleCommand(client.input.substr(0, newline)) + "\n";
+			client.input.erase(0, newline + 1);
+			disconnect = send(client.fd, reply.data(), reply.size(), MSG_NOSIGNAL) != (ssize_t) reply.size();
+		}
+		if (disconnect || client.input.size() > kMaxLineLength) {
+			::close(client.fd);
+			clients.erase(clients.begin() + i);
+		}
+	}
+
+	if (fds[0].revents & POLLIN) {
+		int fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+		if (fd != -1)
+			clients.push_back({fd, std::string()});
+	}
+}
+
+bool
+ControlServer::enqueue(const Command &command)
+{
+	unsigned write = queueWrite.load(std::memory_order_relaxed);
+	if (write - queueRead.load(std::memory_order_acquire) == kQueueSize)
+		return false;
+	queue[write % kQueueSize] = command;
+	queueWrite.store(write + 1, std::memory_order_release);
+	return true;
+}
+
+// As for a MIDI bank select. Returns false if the bank could not be selected
+// yet, e.g. while the bank list is being rescanned.
+static bool
+selectBank(Synthesizer *synth, int index)
+{
+	PresetController *presetController = synth->getPresetController();
+	if (!presetController->selectBank(index))
+		return false;
+	presetController->selectPresetRealtime(presetController->getCurrPresetNumber());
+	return true;
+}
+
+void
+ControlServer::applyCommands()
+{
+	for (size_t part = 0; part < pendingBanks.size(); part++) {
+		PendingBank &pending = pendingBanks[part];
+		if (pending.index != -1 && (selectBank(parts[part], pending.index) || ++pending.attempts >= kMaxSelectBankAttempts))
+			pending = PendingBank();
+	}
+
+	unsigned read = queueRead.load(std::memory_order_relaxed);
+	const unsigned write = queueWrite.load(std::memory_order_acquire);
+	for (; read != write; read++) {
+		const Command &command = queue[read % kQueueSize];
+		Synthesizer *synth = parts[command.part];
+		PresetController *presetController = synth->getPresetController();
+		switch (command.type) {
+			case Command::kSelectBank:
+				// If it fails the bank is parked, replacing any earlier one for
+				// this part, and the commands after it are applied meanwhile.
+				// A preset selected in the meantime is reselected from the new
+				// bank once it is applied.
+				pendingBanks[command.part] = PendingBank();
+				if (!selectBank(synth, command.index)) {
+					pendingBanks[command.part].index = command.index;
+					pendingBanks[command.part].attempts = 1;
+				}
+				break;
+			case Command::kSelectPreset:
+				// As for a MIDI program change
+				synth->_voiceAllocationUnit->HandleMidiAllSoundOff();
+				presetController->selectPresetRealtime(command.index);
+				break;
+			case Command::kSetParameter:
+				synth->setParameterValue((Param) command.index, command.value);
+				break;
+			case Command::kSetMaxVoices:
+				synth->setMaxNumVoices(command.index);
+				break;
+			case Command::kSetMidiChannel:
+				synth->setMidiChannel((unsigned char) command.index);
+				break;
+			case Command::kSetPitchBendRange:
+				synth->setPitchBendRangeSemitones(command.index);
+				break;
+		}
+	}
+	queueRead.store(read, std::memory_order_release);
+}
+
+static std::string
+error(const char *message)
+{
+	return std::string("error ") + message;
+}
+
+std::string
+ControlServer::handleCommand(const std::string &line)
+{
+	std::istringstream args(line);
+	std::string name;
+	if (!(args >> name))
+		return error("empty command");
+
+	if (name == "parts")
+		return "ok " + std::to_string(parts.size());
+
+	if (name == "banks") {
+		const std::vector<BankInfo> &banks = PresetController::getPresetBanks();
+		std::string reply = "ok " + std::to_string(banks.size());
+		for (size_t i = 0; i < banks.size(); i++)
+			reply += "\n" + std::to_string(i) + " " + banks[i].name;
+		return reply;
+	}
+
+	int part;
+	if (!(args >> part))
+		return error("expected a part number");
+	if (part < 0 || part >= (int) parts.size())
+		return error("no such part");
+
+	if (name == "stats") {
+		SynthStatus &status = parts[part]->getStatus();
+		char reply[256];
+		snprintf(reply, sizeof(reply), "ok voices=%d peak_left=%.4f peak_right=%.4f dsp_load=%.4f modified=%d",
+				 status.activeVoices.load(),
+				 SynthStatus::takePeak(status.peakLeft),
+				 SynthStatus::takePeak(status.peakRight),
+				 status.dspLoad.load(),
+				 status.presetModified.load() ? 1 : 0);
+		return reply;
+	}
+
+	Command command = {};
+	command.part = part;
+
+	if (name == "bank" || name == "preset") {
+		if (!(args >> command.index))
+			return error("expected a number");
+		if (name == "bank") {
+			if (command.index < 0 || command.index >= (int) PresetController::getPresetBanks().size())
+				return error("no such bank");
+			command.type = Command::kSelectBank;
+		} else {
+			if (command.index < 0 || command.index >= PresetController::kNumPresets)
+				return error("no such preset");
+			command.type = Command::kSelectPreset;
+		}
+	} else if (name == "param") {
+		std::string parameter;
+		if (!(args >> parameter >> command.value))
+			return error("expected a parameter name and value");
+		if ((command.index = parameter_index_from_name(parameter.c_str())) < 0)
+			return error("no such parameter");
+		command.type = Command::kSetParameter;
+	} else if (name == "property") {
+		std::string property, value;
+		if (!(args >> property) || !std::getline(args >> std::ws, value) || value.empty())
+			return error("expected a property name and value");
+		if (property == PROP_NAME(max_polyphony)) {
+			command.type = Command::kSetMaxVoices;
+		} else if (property == PROP_NAME(midi_channel)) {
+			command.type = Command::kSetMidiChannel;
+		} else if (property == PROP_NAME(pitch_bend_range)) {
+			command.type = Command::kSetPitchBendRange;
+		} else if (property == PROP_NAME(tuning_kbm_file) ||
+				   property == PROP_NAME(tuning_scl_file) ||
+				   property == PROP_NAME(tuning_mts_esp_disabled)) {
+			// Reading tuning files is not realtime safe, so as with the LV2
+			// worker these are applied from this thread
+			parts[part]->setProperty(property.c_str(), value.c_str());
+			return "ok";
+		} else {
+			return error("no such property");
+		}
+		command.index = atoi(value.c_str());
+	} else {
+		return error("unknown command");
+	}
+
+	if (!enqueue(command))
+		return error("busy");
+	return "ok";
+}
@@ -0,0 +1,110 @@
+/*
+ *  ControlServer.h
+ *
+ *  Copyright (c) 2023 Nick Dowell
+ *
+ *  This file is part of amsynth.
+ *
+ *  amsynth is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  amsynth is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with amsynth.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CONTROL_SERVER_H
+#define _CONTROL_SERVER_H
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+class Synthesizer;
+
+/*
+ * Lets other processes drive a headless amsynth over a local UNIX socket.
+ *
+ * Clients send one command per line and receive one line in reply, starting
+ * with "ok" or "error". Parts are numbered from 0.
+ *
+ *   parts                          number of synth parts
+ *   banks                          "ok <n>" followed by n lines "<bank> <name>"
+ *   bank <part> <bank>             select a bank from the list above
+ *   preset <part> <preset>         select a preset in the current bank
+ *   param <part> <name> <value>    set a parameter, e.g. "param 0 filter_cutoff 0.5"
+ *   property <part> <name> <value> set a property, e.g. "property 0 max_polyphony 8"
+ *   stats <part>                   voices, peak levels, DSP load and modified flag
+ *
+ * Commands that touch the DSP are not applied directly; they are queued
+ * without locking and applied by the audio thread at the start of its next
+ * block, so the control side never blocks rendering. Stats are read from
+ * each part's SynthStatus and do not involve the audio thread at all.
+ */
+class ControlServer
+{
+public:
+	explicit ControlServer(const std::vector<Synthesizer *> &parts);
+	~ControlServer();
+
+	// Creates the socket, replacing a stale one at the same path.
+	// Returns 0 on success.
+	int		open			(const std::string &path);
+	void	close			();
+
+	// Serves clients for up to timeout_ms; returns early if interrupted by
+	// a signal. Call repeatedly from the main thread.
+	void	poll			(int timeout_ms);
+
+	// Called by the audio thread before rendering each block
+	void	applyCommands	();
+
+	// Handles a single command line and returns the reply, without the
+	// trailing newline. Exposed so that the protocol can be tested without
+	// a socket.
+	std::string	handleCommand	(const std::string &line);
+
+private:
+	struct Command {
+		enum Type { kSelectBank, kSelectPreset, kSetParameter, kSetMaxVoices, kSetMidiChannel, kSetPitchBendRange };
+		Type type;
+		int part;
+		int index;
+		float value;
+	};
+
+	// Single producer (the thread calling poll) and single consumer (the
+	// audio thread) ring buffer
+	static const unsigned kQueueSize = 1024;
+	bool	enqueue			(const Command &command);
+
+	struct Client {
+		int fd;
+		std::string input;
+	};
+
+	std::vector<Synthesizer *> parts;
+	Command queue[kQueueSize];
+	std::atomic<unsigned> queueRead {0};
+	std::atomic<unsigned> queueWrite {0};
+
+	// A bank select that could not be applied yet, retried in the following
+	// blocks without holding back the other commands. Audio thread only.
+	struct PendingBank {
+		int index = -1;
+		unsigned attempts = 0;
+	};
+	std::vector<PendingBank> pendingBanks;
+
+	std::string socketPath;
+	int listenFd = -1;
+	std::vector<Client> clients;
+};
+
+#endif
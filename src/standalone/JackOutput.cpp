@@ -23,6 +23,7 @@
 
 #include "core/Configuration.h"
 #include "core/midi.h"
+#include "core/synth/MultitimbralSynthesizer.h"
 
 #if HAVE_JACK_MIDIPORT_H
 #include <jack/midiport.h>
@@ -65,6 +66,22 @@ JackOutput::init()
 	l_port = jack_port_register(client, "L out", JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
 	r_port = jack_port_register(client, "R out", JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
 
+	if (config.multitimbral && config.multitimbral_outputs == "separate") {
+		for (int i = 0; i < MultitimbralSynthesizer::kNumParts; i++) {
+			char name[32];
+			snprintf(name, sizeof(name), "part %d L out", i + 1);
+			part_ports_l.push_back(jack_port_register(client, name, JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0));
+			snprintf(name, sizeof(name), "part %d R out", i + 1);
+			part_ports_r.push_back(jack_port_register(client, name, JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0));
+			if (!part_ports_l.back() || !part_ports_r.back()) {
+				std::cerr << "cannot register JACK ports for multitimbral parts\n";
+				part_ports_l.clear();
+				part_ports_r.clear();
+				break;
+			}
+		}
+	}
+
 #if HAVE_JACK_MIDIPORT_H
 	/* create midi input port(s) */
 	m_port = jack_port_register(client, "midi_in", JACK_DEFAULT_MIDI_TYPE, JackPortIsInput, 0);
@@ -115,8 +132,15 @@ JackOutput::process (jack_nframes_t nframes, void *arg)
 		}
 	}
 #endif
+	float *parts_l[MultitimbralSynthesizer::kNumParts], *parts_r[MultitimbralSynthesizer::kNumParts];
+	const bool has_part_ports = !self->part_ports_l.empty();
+	for (size_t i = 0; i < self->part_ports_l.size(); i++) {
+		parts_l[i] = (jack_default_audio_sample_t *) jack_port_get_buffer(self->part_ports_l[i], nframes);
+		parts_r[i] = (jack_default_audio_sample_t *) jack_port_get_buffer(self->part_ports_r[i], nframes);
+	}
 	std::vector<amsynth_midi_cc_t> midi_out;
-	amsynth_audio_callback(lout, rout, nframes, 1, midi_events, midi_out);
+	amsynth_audio_callback(lout, rout, nframes, 1, midi_events, midi_out,
+						   has_part_ports ? parts_l : nullptr, has_part_ports ? parts_r : nullptr);
 #if HAVE_JACK_MIDIPORT_H
 	if (self->m_port_out) {
 		void *port_buffer = jack_port_get_buffer(self->m_port_out, nframes);
@@ -174,5 +198,7 @@ JackOutput::Stop()
 	jack_deactivate(client);
 	jack_client_close(client);
 	client = nullptr;
+	part_ports_l.clear();
+	part_ports_r.clear();
 #endif
 }
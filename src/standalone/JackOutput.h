@@ -29,6 +29,7 @@
 #include "AudioOutput.h"
 
 #include <string>
+#include <vector>
 
 #ifdef WITH_JACK
 #include <jack/jack.h>
@@ -54,6 +55,9 @@ private:
 	jack_port_t 	*r_port = nullptr;
 	jack_port_t 	*m_port = nullptr;
 	jack_port_t 	*m_port_out = nullptr;
+	// per-part outputs in multitimbral mode
+	std::vector<jack_port_t *>	part_ports_l;
+	std::vector<jack_port_t *>	part_ports_r;
 	jack_client_t 	*client = nullptr;
 #endif
 };
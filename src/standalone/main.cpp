@@ -28,6 +28,7 @@
 #include "main.h"
 
 #include "AudioOutput.h"
+#include "ControlServer.h"
 #include "JackOutput.h"
 #include "core/Configuration.h"
 #include "core/filesystem.h"
@@ -35,6 +36,7 @@
 #include "core/midi.h"
 #include "core/synth/LowPassFilter.h"
 #include "core/synth/MidiController.h"
+#include "core/synth/MultitimbralSynthesizer.h"
 #include "core/synth/Synthesizer.h"
 #include "core/synth/VoiceAllocationUnit.h"
 #include "drivers/ALSAMidiDriver.h"
@@ -100,6 +102,8 @@ void ptest ();
 
 static MidiDriver *midiDriver;
 Synthesizer *s_synthesizer;
+static MultitimbralSynthesizer *s_multitimbral;
+static ControlServer *s_controlServer;
 static unsigned char *midiBuffer;
 static const size_t midiBufferSize = 4096;
 static int gui_midi_pipe[2];
@@ -188,6 +192,7 @@ public:
 	: DocumentWindow(PACKAGE_NAME, juce::Colours::lightgrey, juce::DocumentWindow::closeButton | juce::DocumentWindow::minimiseButton)
 	{
 		auto mainComponent = new MainComponent(s_synthesizer->getPresetController(), s_synthesizer->getMidiController());
+		mainComponent->setStatus(&s_synthesizer->getStatus());
 		for (const auto &it : s_synthesizer->getProperties()) {
 			mainComponent->propertyChanged(it.first.c_str(), it.second.c_str());
 		}
@@ -301,10 +306,13 @@ int main( int argc, char *argv[] )
 	
 	bool no_gui = (getenv("AMSYNTH_NO_GUI") != nullptr);
 	int gui_scale_factor = 0;
+	std::string control_socket;
 
 	static struct option longopts[] = {
 		{ "jack_autoconnect", optional_argument, nullptr, 0 },
 		{ "force-device-scale-factor", required_argument, nullptr, 0 },
+		{ "multitimbral", optional_argument, nullptr, 0 },
+		{ "control-socket", required_argument, nullptr, 0 },
 		{ nullptr }
 	};
 	
@@ -339,6 +347,12 @@ int main( int argc, char *argv[] )
 					<< _("	--jack_autoconnect[=<true|false>]") << "\n"
 					<< _("	            automatically connect jack audio ports to hardware I/O ports. (Default: true)") << "\n"
 					<< "\n"
+					<< _("	--multitimbral[=<summed|separate>]") << "\n"
+					<< _("	            play a separate patch on each MIDI channel, with the parts summed or on separate JACK ports") << "\n"
+					<< "\n"
+					<< _("	--control-socket <path>") << "\n"
+					<< _("	            run headless, accepting commands on a UNIX socket at <path>") << "\n"
+					<< "\n"
 					<< _("	--force-device-scale-factor <scale>") << "\n"
 					<< _("	            override the default scaling factor for the control panel") << "\n"
 					<< std::endl;
@@ -383,6 +397,15 @@ int main( int argc, char *argv[] )
 				if (strcmp(longopts[longindex].name, "force-device-scale-factor") == 0) {
 					gui_scale_factor = atoi(optarg);
 				}
+				if (strcmp(longopts[longindex].name, "multitimbral") == 0) {
+					config.multitimbral = true;
+					if (optarg)
+						config.multitimbral_outputs = optarg;
+				}
+				if (strcmp(longopts[longindex].name, "control-socket") == 0) {
+					control_socket = optarg;
+					no_gui = true;
+				}
 				break;
 			default:
 				break;
@@ -402,15 +425,42 @@ int main( int argc, char *argv[] )
 
 	Preset::setIgnoredParameterNames(config.ignored_parameters);
 
-	s_synthesizer = new Synthesizer();
-	s_synthesizer->setSampleRate(config.sample_rate);
-	s_synthesizer->setMaxNumVoices(config.polyphony);
-	s_synthesizer->setMidiChannel(config.midi_channel);
-	s_synthesizer->setPitchBendRangeSemitones(config.pitch_bend_range);
-	if (config.current_tuning_file != "default") {
-		s_synthesizer->loadTuningScale(config.current_tuning_file.c_str());
+	if (config.multitimbral) {
+		// The GUI and the bank/preset functions below operate on the first part
+		s_multitimbral = new MultitimbralSynthesizer();
+		s_multitimbral->setSampleRate(config.sample_rate);
+		s_multitimbral->setMaxNumVoices(config.polyphony);
+		s_multitimbral->setSharedReverb(config.multitimbral_shared_reverb);
+		for (int i = 0; i < MultitimbralSynthesizer::kNumParts; i++) {
+			Synthesizer *part = s_multitimbral->getPart(i);
+			part->setPitchBendRangeSemitones(config.pitch_bend_range);
+			if (config.current_tuning_file != "default") {
+				part->loadTuningScale(config.current_tuning_file.c_str());
+			}
+			part->loadBank(config.current_bank_file.c_str());
+		}
+		s_synthesizer = s_multitimbral->getPart(0);
+	} else {
+		s_synthesizer = new Synthesizer();
+		s_synthesizer->setSampleRate(config.sample_rate);
+		s_synthesizer->setMaxNumVoices(config.polyphony);
+		s_synthesizer->setMidiChannel(config.midi_channel);
+		s_synthesizer->setPitchBendRangeSemitones(config.pitch_bend_range);
+		if (config.current_tuning_file != "default") {
+			s_synthesizer->loadTuningScale(config.current_tuning_file.c_str());
+		}
+		s_synthesizer->loadBank(config.current_bank_file.c_str());
 	}
-	s_synthesizer->loadBank(config.current_bank_file.c_str());
+
+#ifdef ENABLE_REALTIME
+	// Keep the DSP state resident so the audio thread never waits on a page fault
+	if (config.realtime) {
+		if (s_multitimbral)
+			s_multitimbral->lockMemory();
+		else
+			s_synthesizer->lockMemory();
+	}
+#endif
 	
 	amsynth_load_bank(config.current_bank_file.c_str());
 	amsynth_set_preset_number(initial_preset_no);
@@ -424,6 +474,19 @@ int main( int argc, char *argv[] )
 	if (config.current_tuning_file != "default")
 		amsynth_load_tuning_file(config.current_tuning_file.c_str());
 	
+	if (!control_socket.empty()) {
+		std::vector<Synthesizer *> parts;
+		if (s_multitimbral) {
+			for (int i = 0; i < MultitimbralSynthesizer::kNumParts; i++)
+				parts.push_back(s_multitimbral->getPart(i));
+		} else {
+			parts.push_back(s_synthesizer);
+		}
+		s_controlServer = new ControlServer(parts);
+		if (s_controlServer->open(control_socket) != 0)
+			fatal_error(_("error: could not open the control socket"));
+	}
+
 	// errors now detected & reported in the GUI
 	out->Start();
 	
@@ -460,8 +523,14 @@ int main( int argc, char *argv[] )
 #endif
 		printf(_("amsynth running in headless mode, press ctrl-c to exit\n"));
 		signal(SIGINT, &signal_handler);
-		while (!signal_received)
-			sleep(2); // delivery of a signal will wake us early
+		signal(SIGTERM, &signal_handler);
+		while (!signal_received) {
+			// delivery of a signal will wake us early
+			if (s_controlServer)
+				s_controlServer->poll(2000);
+			else
+				sleep(2);
+		}
 		printf("\n");
 		printf(_("shutting down...\n"));
 #ifdef WITH_GUI
@@ -470,6 +539,8 @@ int main( int argc, char *argv[] )
 
 	out->Stop ();
 
+	delete s_controlServer;
+
 	if (config.xruns) std::cerr << config.xruns << _(" audio buffer underruns occurred\n");
 
 	delete out;
@@ -494,7 +565,8 @@ static bool compare(const amsynth_midi_event_t &first, const amsynth_midi_event_
 void amsynth_audio_callback(
 		float *buffer_l, float *buffer_r, unsigned num_frames, int stride,
 		const std::vector<amsynth_midi_event_t> &midi_in,
-		std::vector<amsynth_midi_cc_t> &midi_out)
+		std::vector<amsynth_midi_cc_t> &midi_out,
+		float **parts_l, float **parts_r)
 {
 	std::vector<amsynth_midi_event_t> midi_in_merged = midi_in;
 
@@ -530,7 +602,12 @@ void amsynth_audio_callback(
 
 	std::sort(midi_in_merged.begin(), midi_in_merged.end(), compare);
 
-	if (s_synthesizer) {
+	if (s_controlServer)
+		s_controlServer->applyCommands();
+
+	if (s_multitimbral) {
+		s_multitimbral->process(num_frames, midi_in_merged, midi_out, buffer_l, buffer_r, stride, parts_l, parts_r);
+	} else if (s_synthesizer) {
 		s_synthesizer->process(num_frames, midi_in_merged, midi_out, buffer_l, buffer_r, stride);
 	}
 
@@ -595,7 +672,7 @@ void ptest ()
 	
 	// trigger off some notes for amsynth to render.
 	for (int v=0; v<kNumVoices; v++) {
-		voiceAllocationUnit->HandleMidiNoteOn(60 + v, 1.0f);
+		voiceAllocationUnit->HandleMidiNoteOn(0, 60 + v, 1.0f);
 	}
 	
 	struct rusage usage_before; 
@@ -41,10 +41,12 @@ extern void amsynth_midi_input(unsigned char status, unsigned char data1, unsign
 
 #ifdef __cplusplus
 
+// parts_l and parts_r optionally receive the output of each multitimbral part
 extern void amsynth_audio_callback(
         float *buffer_l, float *buffer_r, unsigned num_frames, int stride,
         const std::vector<amsynth_midi_event_t> &midi_in,
-        std::vector<amsynth_midi_cc_t> &midi_out);
+        std::vector<amsynth_midi_cc_t> &midi_out,
+        float **parts_l = nullptr, float **parts_r = nullptr);
 
 }
 #endif
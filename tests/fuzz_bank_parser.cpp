@@ -0,0 +1,62 @@
+/*
+ *  fuzz_bank_parser.cpp
+ *
+ *  Copyright (c) 2023 Nick Dowell
+ *
+ *  This file is part of amsynth.
+ *
+ *  amsynth is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  amsynth is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with amsynth.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Fuzz target for the bank file parser. Build with libFuzzer:
+//
+//   make amsynth-fuzz-bank-parser CXXFLAGS="-g -fsanitize=fuzzer,address -DAMSYNTH_LIBFUZZER"
+//
+// Without AMSYNTH_LIBFUZZER the program parses the files given as arguments,
+// which is useful for reproducing crashes.
+
+#include "core/synth/PresetController.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	std::unique_ptr<PresetBank> bank(new PresetBank);
+	bank->parse((const char *) data, size, "fuzz");
+	return 0;
+}
+
+#ifndef AMSYNTH_LIBFUZZER
+int main(int argc, char *argv[])
+{
+	for (int i = 1; i < argc; i++) {
+		FILE *file = fopen(argv[i], "rb");
+		if (!file) {
+			perror(argv[i]);
+			return 1;
+		}
+		std::vector<uint8_t> data;
+		uint8_t buffer[4096];
+		size_t count;
+		while ((count = fread(buffer, 1, sizeof(buffer), file)))
+			data.insert(data.end(), buffer, buffer + count);
+		fclose(file);
+		LLVMFuzzerTestOneInput(data.data(), data.size());
+	}
+	return 0;
+}
+#endif
@@ -20,17 +20,33 @@
  */
 
 #include "core/controls.h"
+#include "core/filesystem.h"
 #include "core/midi.h"
 #include "core/synth/LowPassFilter.h"
+#include "core/synth/MemoryArena.h"
 #include "core/synth/MidiController.h"
+#include "core/synth/MultitimbralSynthesizer.h"
 #include "core/synth/Oscillator.h"
+#include "core/synth/Oversampler.h"
+#include "core/synth/PresetController.h"
 #include "core/synth/Synthesizer.h"
+#include "core/synth/TuningMap.h"
 #include "core/synth/VoiceAllocationUnit.h"
 #include "core/synth/VoiceBoard.h"
+#include "core/synth/VoiceBudget.h"
+#include "standalone/ControlServer.h"
 
 #include <cassert>
+#include <cmath>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
 
 #define TEST(name) static void name()
 
@@ -162,6 +178,276 @@ TEST(testMidiAllNotesOff) {
     delete synth;
 }
 
+TEST(testMidiChannelVoices) {
+    static float audioBuffer[64];
+
+    Synthesizer *synth = new Synthesizer();
+    synth->setSampleRate(44100);
+    synth->setParameterValue(kAmsynthParameter_KeyboardMode, KeyboardModePoly);
+
+    std::vector<amsynth_midi_event_t> midiIn;
+    std::vector<amsynth_midi_cc_t> midiOut;
+
+    unsigned char midi[] = {
+        MIDI_STATUS_NOTE_ON | 0, 64, 100,
+        MIDI_STATUS_NOTE_ON | 1, 64, 100,
+    };
+    midiIn.push_back({ 0, 3, &midi[0] });
+    midiIn.push_back({ 0, 3, &midi[3] });
+    synth->process(32, midiIn, midiOut, &audioBuffer[0], &audioBuffer[32]);
+    assert(countActiveVoices(synth) == 2 || 0 == "the same note on two channels should play two voices");
+
+    VoiceAllocationUnit *vau = synth->_voiceAllocationUnit;
+    int voice0 = vau->_keyVoice[0 * 128 + 64], voice1 = vau->_keyVoice[1 * 128 + 64];
+    assert(0 <= voice0 && 0 <= voice1 && voice0 != voice1);
+
+    vau->HandleMidiNoteOff(1, 64, 0);
+    assert(vau->keyPressed[0 * 128 + 64] && !vau->keyPressed[1 * 128 + 64]);
+
+    vau->SetMaxVoices(2);
+    vau->HandleMidiNoteOn(2, 64, 1.f);
+    assert(vau->_keyVoice[1 * 128 + 64] == -1 || 0 == "the released voice should be stolen first");
+    assert(vau->_keyVoice[2 * 128 + 64] == voice1);
+    assert(vau->_keyVoice[0 * 128 + 64] == voice0);
+
+    delete synth;
+}
+
+TEST(testParameterEvents) {
+    // a parameter event takes effect at its frame offset, not at the start of the buffer
+    static float l[2][128], r[2][128];
+    unsigned char midi[4] = { MIDI_STATUS_NOTE_ON, 64, 100 };
+    std::vector<amsynth_midi_event_t> midiIn = {{ 0, 3, midi }};
+    std::vector<amsynth_midi_cc_t> midiOut;
+
+    Synthesizer synths[2];
+    for (int i = 0; i < 2; i++) {
+        synths[i].setSampleRate(44100);
+        // the unchanged value still splits the buffer, so both synths process the same block sizes
+        std::vector<amsynth_parameter_event_t> parametersIn = {{ 40, kAmsynthParameter_Oscillator1Waveform, i ? 0.f : 2.f }};
+        synths[i].process(128, midiIn, parametersIn, midiOut, l[i], r[i]);
+    }
+    for (int i = 0; i < 40; i++)
+        assert(l[0][i] == l[1][i]);
+    assert(memcmp(l[0] + 40, l[1] + 40, sizeof(float) * 88) != 0);
+    assert(synths[1].getParameterValue(kAmsynthParameter_Oscillator1Waveform) == 0);
+}
+
+TEST(testSynthStatus) {
+    static float l[64], r[64];
+    unsigned char midi[4] = { MIDI_STATUS_NOTE_ON, 64, 100 };
+    std::vector<amsynth_midi_event_t> midiIn = {{ 0, 3, midi }};
+    std::vector<amsynth_midi_cc_t> midiOut;
+
+    Synthesizer synth;
+    synth.setSampleRate(44100);
+    synth._presetController->selectPreset(0);
+    synth.process(64, midiIn, midiOut, l, r);
+    SynthStatus &status = synth.getStatus();
+    assert(status.activeVoices == 1);
+    assert(status.dspLoad > 0);
+    assert(!status.presetModified);
+    assert(SynthStatus::takePeak(status.peakLeft) > 0);
+    assert(status.peakLeft == 0);
+
+    synth.setParameterValue(kAmsynthParameter_FilterCutoff, 0.25f);
+    midiIn.clear();
+    synth.process(64, midiIn, midiOut, l, r);
+    assert(status.presetModified);
+
+    synth._presetController->selectPreset(0);
+    synth.process(64, midiIn, midiOut, l, r);
+    assert(!status.presetModified);
+    synth._presetController->setCurrentPresetName(synth._presetController->getPreset(0).getName() + " renamed");
+    synth.process(64, midiIn, midiOut, l, r);
+    assert(status.presetModified);
+}
+
+TEST(testAccumulateOutput) {
+    // mixing into a bus gives the same result as rendering separately and adding
+    static float l[128], r[128], busL[128], busR[128];
+    unsigned char midi[4] = { MIDI_STATUS_NOTE_ON, 64, 100 };
+    std::vector<amsynth_midi_event_t> midiIn = {{ 0, 3, midi }};
+    std::vector<amsynth_midi_cc_t> midiOut;
+
+    for (float spread : {0.f, 1.f}) {
+        Synthesizer synths[2];
+        for (auto &synth : synths) {
+            synth.setSampleRate(44100);
+            synth.setParameterValue(kAmsynthParameter_VoicePanSpread, spread);
+            synth.setParameterValue(kAmsynthParameter_ReverbWet, 0.5f);
+        }
+        synths[1].setAccumulate(true, 0.5f);
+        for (int i = 0; i < 128; i++)
+            busL[i] = busR[i] = 0.25f;
+        synths[0].process(128, midiIn, midiOut, l, r);
+        synths[1].process(128, midiIn, midiOut, busL, busR);
+        for (int i = 0; i < 128; i++) {
+            assert(fabsf(busL[i] - (0.25f + 0.5f * l[i])) < 1e-6f);
+            assert(fabsf(busR[i] - (0.25f + 0.5f * r[i])) < 1e-6f);
+        }
+        assert(synths[1].getStatus().peakLeft > 0 && synths[1].getStatus().peakLeft < 0.5f * 1.01f);
+    }
+}
+
+TEST(testMultitimbral) {
+    static float audioBuffer[2 * 100]; // 100 interleaved stereo frames
+
+    MultitimbralSynthesizer *multi = new MultitimbralSynthesizer();
+    multi->setSampleRate(44100);
+    multi->setMaxNumVoices(2);
+    multi->setSharedReverb(true);
+
+    std::vector<amsynth_midi_event_t> midiIn;
+    std::vector<amsynth_midi_cc_t> midiOut;
+
+    unsigned char midi[] = {
+        MIDI_STATUS_NOTE_ON | 0, 60, 100,
+        MIDI_STATUS_NOTE_ON | 1, 64, 100,
+    };
+    midiIn.push_back({ 0, 3, &midi[0] });
+    midiIn.push_back({ 70, 3, &midi[3] });
+    multi->process(100, midiIn, midiOut, &audioBuffer[0], &audioBuffer[1], 2);
+    assert(countActiveVoices(multi->getPart(0)) == 1);
+    assert(countActiveVoices(multi->getPart(1)) == 1 || 0 == "each part should play its own channel");
+    for (int i = 2; i < MultitimbralSynthesizer::kNumParts; i++)
+        assert(countActiveVoices(multi->getPart(i)) == 0);
+
+    float peak = 0;
+    for (float sample : audioBuffer)
+        peak = std::max(peak, fabsf(sample));
+    assert(peak > 0);
+
+    multi->getPart(2)->_voiceAllocationUnit->HandleMidiNoteOn(2, 67, 1.f);
+    assert(countActiveVoices(multi->getPart(2)) == 1);
+    midiIn.clear();
+    multi->process(64, midiIn, midiOut, &audioBuffer[0], &audioBuffer[1], 2);
+    assert(countActiveVoices(multi->getPart(0)) + countActiveVoices(multi->getPart(1)) == 1 || 0 == "parts should share one voice budget");
+
+    delete multi;
+}
+
+TEST(testVoiceBudget) {
+    static float l[64], r[64];
+
+    VoiceBudget budget;
+    budget.setMaxVoices(2);
+    std::unique_ptr<VoiceAllocationUnit> a(new VoiceAllocationUnit), b(new VoiceAllocationUnit), c(new VoiceAllocationUnit);
+    for (auto unit : {a.get(), b.get(), c.get()})
+        unit->setVoiceBudget(&budget);
+    auto processAll = [&] {
+        for (auto unit : {a.get(), b.get(), c.get()})
+            unit->Process(l, r, 64);
+    };
+
+    a->setVoicePriority(1);
+    a->HandleMidiNoteOn(0, 60, 1.f);
+    b->HandleMidiNoteOn(0, 62, 1.f);
+    processAll();
+    assert(budget.countActiveVoices() == 2);
+
+    c->HandleMidiNoteOn(0, 64, 1.f);
+    processAll();
+    assert(a->countActiveVoices() == 1);
+    assert(b->countActiveVoices() == 0 || 0 == "the lowest priority unit should give up its voice");
+    assert(c->countActiveVoices() == 1);
+
+    c->setReservedVoices(1);
+    b->HandleMidiNoteOn(0, 65, 1.f);
+    processAll();
+    assert(b->countActiveVoices() == 0 || 0 == "voices should not be taken from more important or reserved units");
+    assert(budget.countActiveVoices() == 2);
+
+    c->HandleMidiNoteOn(0, 67, 1.f);
+    processAll();
+    assert(c->countActiveVoices() == 1 || 0 == "a unit at the limit should steal its own voice");
+    assert(budget.countActiveVoices() == 2);
+}
+
+static int blocksUntilReleased(float inaudibleThreshold) {
+    static float l[64], r[64];
+    Synthesizer synth;
+    synth.setSampleRate(44100);
+    synth.setParameterValue(kAmsynthParameter_AmpEnvRelease, 1.f);
+    synth.setParameterValue(kAmsynthParameter_MasterVolume, 0.1f);
+    VoiceAllocationUnit *vau = synth._voiceAllocationUnit;
+    vau->setInaudibleThreshold(inaudibleThreshold);
+    vau->HandleMidiNoteOn(0, 60, 1.f);
+    for (int i = 0; i < 10; i++)
+        vau->Process(l, r, 64);
+    vau->HandleMidiNoteOff(0, 60, 0.f);
+    int blocks = 0;
+    while (vau->countActiveVoices() && blocks < 100000) {
+        vau->Process(l, r, 64);
+        blocks++;
+    }
+    return blocks;
+}
+
+TEST(testInaudibleVoices) {
+    int untilSilent = blocksUntilReleased(0);
+    int untilInaudible = blocksUntilReleased(-60);
+    assert(untilInaudible < untilSilent || 0 == "inaudible voices should be stopped early");
+
+    static float l[64], r[64];
+    Synthesizer synth;
+    synth.setSampleRate(44100);
+    synth.setParameterValue(kAmsynthParameter_AmpEnvRelease, 1.f);
+    VoiceAllocationUnit *vau = synth._voiceAllocationUnit;
+    vau->SetMaxVoices(2);
+    vau->HandleMidiNoteOn(0, 60, 1.0f);
+    vau->HandleMidiNoteOn(0, 62, 0.2f);
+    vau->Process(l, r, 64);
+    vau->HandleMidiNoteOff(0, 62, 0.f);
+    vau->HandleMidiNoteOff(0, 60, 0.f);
+    vau->Process(l, r, 64);
+    int quiet = vau->_keyVoice[62];
+    vau->HandleMidiNoteOn(0, 64, 1.0f);
+    assert(vau->_keyVoice[62] == -1 || 0 == "the quietest voice should be stolen");
+    assert(vau->_keyVoice[64] == quiet && 0 <= vau->_keyVoice[60]);
+}
+
+TEST(testStereoVoices) {
+    static float l[64], r[64];
+    Synthesizer synth;
+    synth.setSampleRate(44100);
+    VoiceAllocationUnit *vau = synth._voiceAllocationUnit;
+    vau->HandleMidiNoteOn(0, 60, 1.0f);
+    vau->Process(l, r, 64);
+    for (int i = 0; i < 64; i++)
+        assert(l[i] == r[i] || 0 == "voices should be centred by default");
+
+    synth.setParameterValue(kAmsynthParameter_VoicePanSpread, 1.f);
+    synth.setParameterValue(kAmsynthParameter_VoicePanMode, VoicePanModeKey);
+    vau->HandleMidiAllSoundOff();
+    vau->HandleMidiNoteOn(0, 108, 1.0f);
+    float left = 0, right = 0;
+    for (int block = 0; block < 4; block++) {
+        vau->Process(l, r, 64);
+        for (int i = 0; i < 64; i++) {
+            left += fabsf(l[i]);
+            right += fabsf(r[i]);
+        }
+    }
+    assert((right > 0 && left == 0) || 0 == "a high key should be panned right");
+}
+
+TEST(testUnisonSpreadSurvivesOtherParameters) {
+    Synthesizer synth;
+    synth.setSampleRate(44100);
+    VoiceAllocationUnit *vau = synth._voiceAllocationUnit;
+    synth.setParameterValue(kAmsynthParameter_UnisonVoices, 4.f);
+    synth.setParameterValue(kAmsynthParameter_UnisonSpread, 1.f);
+    assert(vau->isStereo());
+
+    // Any other voice parameter used to overwrite the spread
+    synth.setParameterValue(kAmsynthParameter_LFOToAmp, 1.f);
+    synth.setParameterValue(kAmsynthParameter_LFOToAmp, 0.f);
+    assert(vau->mUnisonVoices == 4);
+    assert(vau->mUnisonSpread == 1.f);
+    assert(vau->isStereo());
+}
+
 TEST(testPresetIgnoredParameters) {
     Preset basePreset;
     basePreset.getParameter(0).setValue(1);
@@ -174,6 +460,328 @@ TEST(testPresetIgnoredParameters) {
     assert(!basePreset.isEqual(newPreset));
 }
 
+TEST(testPresetBanksAreShared) {
+    char path[] = "/tmp/amsynth-tests-XXXXXX";
+    close(mkstemp(path));
+
+    PresetController first, second;
+    first.setCurrPresetNumber(0);
+    first.getCurrentPreset().setName("shared");
+    first.commitPreset();
+    first.savePresets(path);
+    second.loadPresets(path);
+    assert(&first.getPreset(0) == &second.getPreset(0) || 0 == "instances should share the bank contents");
+
+    first.getCurrentPreset().setName("modified");
+    first.commitPreset();
+    assert(first.getPreset(0).getName() == "modified");
+    assert(second.getPreset(0).getName() == "shared" || 0 == "other instances should not see uncommitted changes");
+
+    remove(path);
+}
+
+TEST(testSelectPresetRealtime) {
+    PresetController presetController;
+    presetController.setCurrPresetNumber(1);
+    presetController.getCurrentPreset().setName("second");
+    presetController.getCurrentPreset().getParameter(kAmsynthParameter_MasterVolume).setValue(0.25f);
+    presetController.commitPreset();
+    presetController.selectPreset(0);
+
+    assert(presetController.selectPresetRealtime(1) == 0);
+    assert(presetController.getCurrPresetNumber() == 1);
+    assert(presetController.getCurrentPreset().getName() == "second");
+    assert(presetController.getCurrentPreset().getParameter(kAmsynthParameter_MasterVolume).getValue() == 0.25f);
+    assert(!presetController.isCurrentPresetModified());
+    assert(presetController.selectPresetRealtime(PresetController::kNumPresets) == -1);
+}
+
+TEST(testSelectBankRealtime) {
+    const std::vector<BankInfo> &banks = PresetController::getPresetBanks();
+    assert(banks.size() >= 2);
+
+    PresetController presetController;
+    assert(!presetController.selectBank(-1));
+    assert(!presetController.selectBank((int) banks.size()));
+
+    // Switching away from a private copy of a bank hands it over to be
+    // released off the audio thread
+    presetController.setCurrPresetNumber(0);
+    presetController.getCurrentPreset().setName("private");
+    presetController.commitPreset();
+    assert(presetController.selectBank(1));
+    assert(presetController.getFilePath() == banks[1].file_path);
+    PresetController::releaseRetiredBanks();
+
+    // Banks that are still in the list are switched between directly, so
+    // this keeps working without anything releasing retired banks
+    for (int i = 0; i < 100; i++)
+        assert(presetController.selectBank(i % 2));
+    assert(presetController.getFilePath() == banks[1].file_path);
+}
+
+TEST(testSelectBankWithLongPath) {
+    // A bank whose path is longer than any loaded before must still be
+    // selectable after loadPresets has replaced the file path
+    char dir[] = "/tmp/amsynth-tests-XXXXXX";
+    assert(mkdtemp(dir));
+    const std::string longDir = std::string(dir) + "/" + std::string(200, 'x');
+    assert(mkdir(longDir.c_str(), 0700) == 0);
+    const std::string longPath = longDir + "/long.bank";
+    std::ofstream(longPath) << "amSynth\n<preset> <name> long\nEOF\n";
+    std::string userBanks = filesystem::get().user_banks;
+    filesystem::get().user_banks = longDir;
+    PresetController::rescanPresetBanks();
+    {
+        const std::vector<BankInfo> &banks = PresetController::getPresetBanks();
+        int longBank = -1, shortBank = -1;
+        for (int i = 0; i < (int) banks.size(); i++) {
+            if (banks[i].file_path == longPath)
+                longBank = i;
+            else if (shortBank == -1 || banks[i].file_path.size() < banks[shortBank].file_path.size())
+                shortBank = i;
+        }
+        assert(longBank != -1 && shortBank != -1);
+
+        PresetController presetController;
+        assert(presetController.loadPresets(banks[shortBank].file_path.c_str()) == 0);
+        assert(presetController.loadPresets() == 0); // as saveCurrentPreset does
+        assert(presetController.selectBank(longBank));
+        assert(presetController.selectPresetRealtime(0) == 0);
+        assert(presetController.getCurrentPreset().getName() == "long");
+        assert(presetController.getFilePath() == longPath);
+    }
+    filesystem::get().user_banks = userBanks;
+    PresetController::rescanPresetBanks();
+    assert(remove(longPath.c_str()) == 0);
+    assert(rmdir(longDir.c_str()) == 0);
+    assert(rmdir(dir) == 0);
+}
+
+TEST(testBankFileParser) {
+    std::unique_ptr<PresetBank> bank(new PresetBank);
+    std::string data = "amSynth\n"
+        "<preset> <name> First\r\n"
+        "<parameter> master_vol 1e-01\r\n"
+        "<parameter> no_such_parameter 1\n"
+        "<parameter> filter_cutoff -0.25\n"
+        "<parameter> amp_attack garbage\n"
+        "<preset> <name> Second preset\n"
+        "<parameter> osc2_detune .5\n"
+        "EOF\n";
+    assert(bank->parse(data.data(), data.size(), "test"));
+    assert(bank->presets[0].getName() == "First");
+    assert(bank->presets[0].getParameter(kAmsynthParameter_MasterVolume).getValue() == 0.1f);
+    assert(bank->presets[0].getParameter(kAmsynthParameter_FilterCutoff).getValue() == -0.25f);
+    assert(bank->presets[0].getParameter(kAmsynthParameter_AmpEnvAttack).getValue() == 0.f);
+    assert(bank->presets[1].getName() == "Second preset");
+    assert(bank->presets[1].getParameter(kAmsynthParameter_Oscillator2Detune).getValue() == 0.5f);
+
+    data = "amSynth\n<parameter> master_vol 1\n";
+    assert(!PresetBank().parse(data.data(), data.size(), "test") || 0 == "parameters must belong to a preset");
+
+    data = "amSynth\n";
+    for (int i = 0; i <= PresetController::kNumPresets; i++)
+        data += "<preset> <name> preset\n";
+    assert(!PresetBank().parse(data.data(), data.size(), "test") || 0 == "more than 128 presets should be rejected");
+
+    assert(!PresetBank().parse("amSynt", 6, "test"));
+}
+
+// How bank values were read before the current parser, kept as a reference
+static float legacyFloatFromString(const char *s) {
+    if (strchr(s, 'e'))
+        return Parameter::valueFromString(std::string(s));
+    float rez = 0, fact = 1;
+    if (*s == '-') {
+        s++;
+        fact = -1;
+    }
+    for (int point_seen = 0; *s; s++) {
+        if (*s == '.') {
+            point_seen = 1;
+            continue;
+        }
+        int d = *s - '0';
+        if (d >= 0 && d <= 9) {
+            if (point_seen) fact /= 10.0f;
+            rez = rez * 10.0f + (float)d;
+        }
+    }
+    return rez * fact;
+}
+
+TEST(testBankValuesParseAsBefore) {
+    // Every value in the shipped banks must load exactly as it used to, so
+    // that existing sounds and comparisons with saved banks are unchanged
+    int count = 0;
+    for (const BankInfo &bank : PresetController::getPresetBanks()) {
+        if (!bank.read_only)
+            continue;
+        std::ifstream file(bank.file_path);
+        std::string line;
+        while (std::getline(file, line)) {
+            if (line.compare(0, 12, "<parameter> ") != 0)
+                continue;
+            if (!line.empty() && line.back() == '\r')
+                line.pop_back();
+            const std::string text = line.substr(line.find(' ', 12) + 1);
+            float value;
+            assert(Parameter::parseValue(text.data(), text.data() + text.size(), value) == text.data() + text.size());
+            const float expected = legacyFloatFromString(text.c_str());
+            assert(memcmp(&value, &expected, sizeof(float)) == 0);
+            count++;
+        }
+    }
+    assert(count > 10000);
+}
+
+#ifdef __linux__
+static void waitForBanksChange(unsigned changeCount) {
+    for (int i = 0; i < 200 && PresetController::getBanksChangeCount() == changeCount; i++)
+        usleep(10000);
+    assert(PresetController::getBanksChangeCount() != changeCount || 0 == "bank watcher should notice external changes");
+}
+
+TEST(testBankWatcher) {
+    // Watch a temporary directory in place of the user's banks
+    char dir[] = "/tmp/amsynth-tests-XXXXXX";
+    assert(mkdtemp(dir));
+    std::string userBanks = filesystem::get().user_banks;
+    filesystem::get().user_banks = dir;
+    {
+        PresetController presetController;
+        std::string path = std::string(dir) + "/amsynth-tests.bank";
+
+        unsigned changeCount = PresetController::getBanksChangeCount();
+        std::ofstream(path) << "amSynth\n<preset> <name> external\nEOF\n";
+        waitForBanksChange(changeCount);
+        assert(presetController.loadPresets(path.c_str()) == 0);
+        assert(presetController.getPreset(0).getName() == "external");
+
+        changeCount = PresetController::getBanksChangeCount();
+        std::ofstream(path) << "amSynth\n<preset> <name> modified\nEOF\n";
+        waitForBanksChange(changeCount);
+        assert(presetController.loadPresets(path.c_str()) == 0);
+        assert(presetController.getPreset(0).getName() == "modified");
+
+        // Our own saves are not reported as external changes
+        changeCount = PresetController::getBanksChangeCount();
+        presetController.selectPreset(0);
+        presetController.getCurrentPreset().setName("saved");
+        presetController.saveCurrentPreset();
+        assert(PresetController::waitForPendingSaves());
+        usleep(200000);
+        assert(PresetController::getBanksChangeCount() == changeCount);
+
+        assert(remove(path.c_str()) == 0);
+    }
+    filesystem::get().user_banks = userBanks;
+    assert(rmdir(dir) == 0);
+}
+#endif
+
+static std::string readFile(const std::string &path) {
+    std::ifstream file(path);
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+TEST(testSaveBank) {
+    char dir[] = "/tmp/amsynth-tests-XXXXXX";
+    assert(mkdtemp(dir));
+    std::string path = std::string(dir) + "/test.bank";
+    std::ofstream(path) << "amSynth\nEOF\n";
+
+    PresetController presetController;
+    assert(presetController.loadPresets(path.c_str()) == 0);
+    presetController.selectPreset(0);
+    presetController.getCurrentPreset().setName("one");
+    presetController.saveCurrentPreset();
+    presetController.selectPreset(1);
+    presetController.getCurrentPreset().setName("two");
+    presetController.getCurrentPreset().getParameter(kAmsynthParameter_MasterVolume).setValue(0.5f);
+    presetController.saveCurrentPreset();
+    assert(PresetController::waitForPendingSaves());
+
+    std::string contents = readFile(path);
+    assert(contents.find("amSynth\n<preset> <name> one\n") == 0);
+    assert(contents.find("<preset> <name> two\n") != std::string::npos);
+    assert(contents.find("<parameter> master_vol 0.5\n") != std::string::npos);
+    assert(contents.compare(contents.size() - 4, 4, "EOF\n") == 0);
+
+    PresetController other;
+    assert(other.loadPresets(path.c_str()) == 0);
+    assert(other.getPreset(1).getName() == "two");
+
+    assert(remove(path.c_str()) == 0);
+    assert(rmdir(dir) == 0 || 0 == "no temporary files should be left behind");
+}
+
+TEST(testFailedSaveIsReportedToEveryWaiter) {
+    char dir[] = "/tmp/amsynth-tests-XXXXXX";
+    assert(mkdtemp(dir));
+    std::string path = std::string(dir) + "/test.bank";
+    std::ofstream(path) << "amSynth\nEOF\n";
+
+    PresetController presetController;
+    assert(presetController.loadPresets(path.c_str()) == 0);
+    assert(remove(path.c_str()) == 0);
+    assert(rmdir(dir) == 0);
+    assert(PresetController::waitForPendingSaves());
+
+    presetController.selectPreset(0);
+    presetController.getCurrentPreset().setName("lost");
+    presetController.saveCurrentPreset();
+    bool otherWaiterOk = true;
+    std::thread otherWaiter([&] { otherWaiterOk = PresetController::waitForPendingSaves(); });
+    assert(!PresetController::waitForPendingSaves());
+    otherWaiter.join();
+    assert(!otherWaiterOk);
+    assert(PresetController::waitForPendingSaves());
+
+    // A failure between two waits is reported by the second
+    assert(presetController.savePresets() == -1);
+    assert(!PresetController::waitForPendingSaves());
+}
+
+TEST(testTuningMap) {
+    TuningMap tuningMap;
+    assert(tuningMap.isDefault());
+    assert(fabs(tuningMap.noteToPitch(69) - 440.) < 1e-9);
+    assert(fabs(tuningMap.noteToPitch(81) - 880.) < 1e-9);
+
+    char path[] = "/tmp/amsynth-tests-XXXXXX";
+    close(mkstemp(path));
+    std::ofstream(path) << "! invalid key map, with an active range\n< 0 10\n-1\n";
+    assert(tuningMap.loadKeyMap(path) == -1);
+    assert(tuningMap.inActiveRange(60) || 0 == "failed loads should not change the tuning");
+
+    std::ofstream(path) << "19 equal\n19\n" << []{
+        std::string scale;
+        for (int i = 1; i <= 19; i++)
+            scale += std::to_string(i * 1200. / 19.) + "\n";
+        return scale;
+    }();
+    assert(tuningMap.loadScale(path) == 0);
+    assert(!tuningMap.isDefault());
+    assert(fabs(tuningMap.noteToPitch(69) - 440.) < 1e-9);
+    assert(fabs(tuningMap.noteToPitch(69 + 19) - 880.) < 1e-6);
+    remove(path);
+
+    tuningMap.defaultScale();
+    assert(tuningMap.isDefault());
+    assert(fabs(tuningMap.noteToPitch(81) - 880.) < 1e-9);
+
+    // Replaced tables are freed as the tuning keeps changing, except the one
+    // last read, which stays valid until the next read
+    for (int i = 0; i < 1000; i++) {
+        const double pitch = tuningMap.noteToPitch(i % 128);
+        tuningMap.defaultKeyMap();
+        tuningMap.defaultScale();
+        assert(tuningMap.noteToPitch(i % 128) == pitch);
+    }
+}
+
 static size_t count(const char **strings) {
     size_t count;
     for (count = 0; strings[count]; count ++);
@@ -184,10 +792,11 @@ TEST(testPresetValueStrings) {
     assert(count(parameter_get_value_strings(kAmsynthParameter_Oscillator1Waveform)) == (int)Oscillator::Waveform::kRandom + 1);
     assert(count(parameter_get_value_strings(kAmsynthParameter_Oscillator2Waveform)) == (int)Oscillator::Waveform::kRandom + 1);
     assert(count(parameter_get_value_strings(kAmsynthParameter_KeyboardMode)) == KeyboardModeLegato + 1);
-    assert(count(parameter_get_value_strings(kAmsynthParameter_FilterType)) == (int)SynthFilter::Type::kBypass + 1);
+    assert(count(parameter_get_value_strings(kAmsynthParameter_FilterType)) == (int)SynthFilter::Type::kSVFBandStop + 1);
     assert(count(parameter_get_value_strings(kAmsynthParameter_FilterSlope)) == (int)SynthFilter::Slope::k12 + 2);
     assert(count(parameter_get_value_strings(kAmsynthParameter_LFOOscillatorSelect)) == 3);
     assert(count(parameter_get_value_strings(kAmsynthParameter_PortamentoMode)) == PortamentoModeLegato + 1);
+    assert(count(parameter_get_value_strings(kAmsynthParameter_VoicePanMode)) == VoicePanModeRandom + 1);
 }
 
 TEST(testOscillatorHighFrequency) {
@@ -201,6 +810,308 @@ TEST(testOscillatorHighFrequency) {
     }
 }
 
+TEST(testUnisonOscillator) {
+    static float mono[64], left[64], right[64];
+
+    Oscillator osc;
+    UnisonOscillator unison;
+    osc.SetSampleRate(44100);
+    unison.SetSampleRate(44100);
+    unison.setVoices(1, 0.f, 0.f);
+    for (int block = 0; block < 8; block++) {
+        osc.ProcessSamples(mono, 64, 440, 0.f);
+        unison.ProcessSamples(left, right, 64, 440, 0.f);
+        for (int i = 0; i < 64; i++) {
+            assert(fabsf(mono[i] - (left[i] + right[i])) < 1e-3f || 0 == "a single copy should match Oscillator");
+        }
+    }
+
+    unison.SetWaveform(Oscillator::Waveform::kSaw);
+    unison.setVoices(UnisonOscillator::kMaxVoices, 1.f, 1.f);
+    unison.ProcessSamples(left, right, 64, 440, 0.5f);
+    bool stereo = false;
+    for (int i = 0; i < 64; i++) {
+        assert(std::isfinite(left[i]) && std::isfinite(right[i]));
+        stereo |= left[i] != right[i];
+    }
+    assert(stereo || 0 == "spread copies should differ between left and right");
+
+    for (int waveform = (int)Oscillator::Waveform::kSine; waveform <= (int)Oscillator::Waveform::kRandom; waveform++) {
+        unison.SetWaveform((Oscillator::Waveform)waveform);
+        unison.ProcessSamples(left, right, 64, 99999, 0.5f);
+    }
+}
+
+static float rms(const float *buffer, int nFrames) {
+    double sum = 0;
+    for (int i = 0; i < nFrames; i++)
+        sum += buffer[i] * buffer[i];
+    return (float) sqrt(sum / nFrames);
+}
+
+// The double precision direct form biquads of the classic filter types,
+// written out independently as a reference.
+struct ReferenceBiquad {
+    double d1 = 0, d2 = 0, d3 = 0, d4 = 0;
+
+    void process(float *buffer, int numSamples, float rate, float cutoff, float res, int type, bool cascade) {
+        const double w = cutoff / rate;
+        const double r = std::max(0.001, 2.0 * (1.0 - res));
+        const double k = tan(w * m::pi), k2 = k * k, rk = r * k, bh = 1.0 + rk + k2;
+        double a0, a1, a2;
+        const double b1 = (2.0 * (k2 - 1.0)) / bh, b2 = (1.0 - rk + k2) / bh;
+        switch (type) {
+            case 0: a0 = k2 / bh; a1 = a0 * 2.0; a2 = a0; break;
+            case 1: a0 = 1.0 / bh; a1 = -2.0 / bh; a2 = a0; break;
+            case 2: a0 = rk / bh; a1 = 0.0; a2 = -rk / bh; break;
+            default: a0 = (1.0 + k2) / bh; a1 = b1; a2 = a0; break;
+        }
+        for (int i = 0; i < numSamples; i++) {
+            double x = buffer[i], y;
+            y = a0 * x + d1; d1 = d2 + a1 * x - b1 * y; d2 = a2 * x - b2 * y;
+            if (cascade) {
+                x = y;
+                y = a0 * x + d3; d3 = d4 + a1 * x - b1 * y; d4 = a2 * x - b2 * y;
+            }
+            buffer[i] = (float) y;
+        }
+    }
+};
+
+TEST(testFilterMatchesDoubleBiquad) {
+    // The classic types must render exactly as they always have, so that
+    // existing presets sound the same. The float SVF types should track
+    // them closely, including at low cutoffs where a float direct form
+    // implementation loses precision.
+    static float expected[64], actual[64];
+    const SynthFilter::Type types[][2] = {
+        {SynthFilter::Type::kLowPass, SynthFilter::Type::kSVFLowPass},
+        {SynthFilter::Type::kHighPass, SynthFilter::Type::kSVFHighPass},
+        {SynthFilter::Type::kBandPass, SynthFilter::Type::kSVFBandPass},
+        {SynthFilter::Type::kBandStop, SynthFilter::Type::kSVFBandStop},
+    };
+    for (int type = 0; type < 4; type++) {
+        for (auto filterType : types[type]) {
+            for (float cutoff : {20.f, 30.f, 2000.f, 15000.f}) {
+                for (int slope = 0; slope < 2; slope++) {
+                    ReferenceBiquad reference;
+                    SynthFilter filter;
+                    filter.SetSampleRate(44100);
+                    for (int block = 0, n = 0; block < 16; block++) {
+                        for (int i = 0; i < 64; i++, n++)
+                            expected[i] = actual[i] = (n % 100 < 50 ? 0.5f : -0.5f);
+                        reference.process(expected, 64, 44100, cutoff, 0.5f, type, slope == 1);
+                        filter.ProcessSamples(actual, 64, cutoff, 0.5f, filterType, (SynthFilter::Slope)slope);
+                        for (int i = 0; i < 64; i++) {
+                            if (filterType < SynthFilter::Type::kSVFLowPass)
+                                assert(expected[i] == actual[i]);
+                            else
+                                assert(fabsf(expected[i] - actual[i]) < 1e-3f);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // Interleaved lanes give the same result as separate filters
+    static float interleaved[64 * 4], separate[4][64];
+    SynthFilterLanes<4> lanes;
+    SynthFilter filters[4];
+    lanes.SetSampleRate(44100);
+    for (int lane = 0; lane < 4; lane++) {
+        filters[lane].SetSampleRate(44100);
+        lanes.setCutoff(lane, 100.f * (lane + 1) * (lane + 1), 0.25f * lane);
+    }
+    for (int block = 0, n = 0; block < 4; block++) {
+        for (int i = 0; i < 64; i++, n++)
+            for (int lane = 0; lane < 4; lane++)
+                interleaved[i * 4 + lane] = separate[lane][i] = sinf(n * (lane + 1) * 0.05f);
+        lanes.ProcessSamples(interleaved, 64, SynthFilterLanes<4>::Mode::kLowPass, true);
+        for (int lane = 0; lane < 4; lane++) {
+            filters[lane].ProcessSamples(separate[lane], 64, 100.f * (lane + 1) * (lane + 1), 0.25f * lane,
+                                         SynthFilter::Type::kSVFLowPass, SynthFilter::Slope::k24);
+            for (int i = 0; i < 64; i++)
+                assert(interleaved[i * 4 + lane] == separate[lane][i]);
+        }
+    }
+
+    // The filter stays bounded with a resonant cutoff jumping to nyquist and
+    // back, which drives the direct form biquad to infinity
+    SynthFilter filter;
+    filter.SetSampleRate(44100);
+    for (int block = 0; block < 256; block++) {
+        for (int i = 0; i < 64; i++)
+            actual[i] = i % 2 ? 1.f : -1.f;
+        filter.ProcessSamples(actual, 64, block % 2 ? 30000.f : 50.f, 0.97f, SynthFilter::Type::kSVFLowPass, SynthFilter::Slope::k24);
+        for (int i = 0; i < 64; i++)
+            assert(std::isfinite(actual[i]) && fabsf(actual[i]) < 1e4f);
+    }
+}
+
+TEST(testOversampler) {
+    static float in[64], high[64 * Oversampler::kMaxFactor], out[64];
+
+    for (int factor = 2; factor <= Oversampler::kMaxFactor; factor *= 2) {
+        // a tone well below nyquist passes through unchanged
+        Oversampler oversampler;
+        oversampler.setFactor(factor);
+        for (int block = 0, n = 0; block < 8; block++) {
+            for (int i = 0; i < 64; i++, n++)
+                in[i] = sinf(2 * M_PI * 1000 * n / 44100);
+            oversampler.upsample(in, high, 64);
+            oversampler.downsample(high, out, 64);
+        }
+        assert(fabsf(rms(out, 64) - rms(in, 64)) < 0.01f);
+
+        // a tone above the base rate's nyquist is removed by the decimator
+        oversampler.reset();
+        for (int block = 0, n = 0; block < 8; block++) {
+            for (int i = 0; i < 64 * factor; i++, n++)
+                high[i] = sinf(2 * M_PI * 30000 * n / (44100 * factor));
+            oversampler.downsample(high, out, 64);
+        }
+        assert(rms(out, 64) < 0.001f);
+    }
+
+    // the reported latency matches the delay of an impulse through both directions
+    for (int factor = 2; factor <= Oversampler::kMaxFactor; factor *= 2) {
+        Oversampler oversampler;
+        oversampler.setFactor(factor);
+        int peak = 0;
+        float peakValue = 0;
+        for (int block = 0, n = 0; block < 2; block++) {
+            for (int i = 0; i < 64; i++, n++)
+                in[i] = n == 0 ? 1.f : 0.f;
+            oversampler.upsample(in, high, 64);
+            oversampler.downsample(high, out, 64);
+            for (int i = 0; i < 64; i++) {
+                if (fabsf(out[i]) > peakValue) {
+                    peakValue = fabsf(out[i]);
+                    peak = block * 64 + i;
+                }
+            }
+        }
+        assert(fabsf(peak - 2 * oversampler.getLatency()) <= 0.5f);
+    }
+
+    static float l[64], r[64];
+    Synthesizer synth;
+    synth.setSampleRate(44100);
+    synth.setParameterValue(kAmsynthParameter_AmpDistortion, 0.5f);
+    assert(synth.getLatency() == 0);
+    synth._voiceAllocationUnit->setOversampling(4);
+    assert(synth.getLatency() == 52);
+    synth._voiceAllocationUnit->HandleMidiNoteOn(0, 100, 1.0f);
+    for (int block = 0; block < 8; block++)
+        synth._voiceAllocationUnit->Process(l, r, 64);
+    assert(std::isfinite(rms(l, 64)) && rms(l, 64) > 0);
+}
+
+TEST(testMemoryArena) {
+    MemoryArena arena(4096);
+    void *a = arena.allocate(1);
+    void *b = arena.allocate(100);
+    assert((uintptr_t) a % MemoryArena::kAlignment == 0);
+    assert((uintptr_t) b % MemoryArena::kAlignment == 0);
+    assert((char *) b - (char *) a == MemoryArena::kAlignment);
+    assert(arena.getUsed() == 3 * MemoryArena::kAlignment);
+    assert(arena.allocate(4096) == nullptr);
+    assert(arena.allocate(4096 - arena.getUsed()) != nullptr);
+
+    // All of a synth's DSP state comes from its arena, voices first and adjacent
+    Synthesizer synth;
+    VoiceAllocationUnit *vau = synth._voiceAllocationUnit;
+    const MemoryArena &voiceArena = vau->mArena;
+    for (int i = 0; i < VoiceAllocationUnit::kNumVoices; i++)
+        assert(voiceArena.contains(vau->_voices[i]));
+    assert((char *) vau->_voices[1] - (char *) vau->_voices[0] == (ptrdiff_t) MemoryArena::sizeFor(sizeof(VoiceBoard)));
+    assert(voiceArena.contains(vau->limiter));
+    assert(voiceArena.contains(vau->reverb));
+    assert(voiceArena.contains(vau->distortion));
+    assert(voiceArena.contains(vau->mBuffer));
+    assert(voiceArena.getUsed() == voiceArena.getCapacity());
+}
+
+TEST(testControlServer) {
+    Synthesizer synth0, synth1;
+    ControlServer server({&synth0, &synth1});
+
+    assert(server.handleCommand("parts") == "ok 2");
+    assert(server.handleCommand("param 1 filter_cutoff 0.25") == "ok");
+    assert(server.handleCommand("property 1 max_polyphony 7") == "ok");
+    assert(server.handleCommand("preset 0 3") == "ok");
+
+    // Nothing changes until the audio thread picks the commands up
+    assert(synth1.getParameterValue(kAmsynthParameter_FilterCutoff) != 0.25f);
+    assert(synth1.getMaxNumVoices() != 7);
+    server.applyCommands();
+    assert(synth1.getParameterValue(kAmsynthParameter_FilterCutoff) == 0.25f);
+    assert(synth1.getMaxNumVoices() == 7);
+    assert(synth0.getMaxNumVoices() != 7);
+    assert(synth0.getPresetNumber() == 3);
+
+    const std::vector<BankInfo> &banks = PresetController::getPresetBanks();
+    assert(banks.size() >= 2);
+    assert(server.handleCommand("bank 0 1") == "ok");
+    server.applyCommands();
+    assert(synth0.getPresetController()->getFilePath() == banks[1].file_path);
+
+    // A bank select that cannot be applied does not hold back the commands
+    // after it. This bank's path is too long to be selected on the audio thread.
+    char dir[] = "/tmp/amsynth-tests-XXXXXX";
+    assert(mkdtemp(dir));
+    std::vector<std::string> dirs(1, dir);
+    for (int i = 0; i < 5; i++) {
+        dirs.push_back(dirs.back() + "/" + std::string(220, 'x'));
+        assert(mkdir(dirs.back().c_str(), 0700) == 0);
+    }
+    const std::string longPath = dirs.back() + "/long.bank";
+    std::ofstream(longPath) << "amSynth\nEOF\n";
+    std::string userBanks = filesystem::get().user_banks;
+    filesystem::get().user_banks = dirs.back();
+    PresetController::rescanPresetBanks();
+    int longBank = -1;
+    for (int i = 0; i < (int) banks.size(); i++)
+        if (banks[i].file_path == longPath)
+            longBank = i;
+    assert(longBank != -1);
+    assert(server.handleCommand("bank 0 " + std::to_string(longBank)) == "ok");
+    assert(server.handleCommand("param 0 filter_cutoff 0.125") == "ok");
+    server.applyCommands();
+    assert(synth0.getParameterValue(kAmsynthParameter_FilterCutoff) == 0.125f);
+    assert(synth0.getPresetController()->getFilePath() != longPath);
+
+    // A later bank select replaces the one still being retried
+    const int otherBank = longBank == 0 ? 1 : 0;
+    assert(server.handleCommand("bank 0 " + std::to_string(otherBank)) == "ok");
+    for (int i = 0; i < 10; i++)
+        server.applyCommands();
+    assert(synth0.getPresetController()->getFilePath() == banks[otherBank].file_path);
+
+    filesystem::get().user_banks = userBanks;
+    PresetController::rescanPresetBanks();
+    assert(remove(longPath.c_str()) == 0);
+    for (size_t i = dirs.size(); i-- > 0; )
+        assert(rmdir(dirs[i].c_str()) == 0);
+
+    assert(server.handleCommand("stats 1").compare(0, 10, "ok voices=") == 0);
+    assert(server.handleCommand("").compare(0, 6, "error ") == 0);
+    assert(server.handleCommand("frobnicate").compare(0, 6, "error ") == 0);
+    assert(server.handleCommand("param 2 filter_cutoff 0.5").compare(0, 6, "error ") == 0);
+    assert(server.handleCommand("param 0 no_such_parameter 0.5").compare(0, 6, "error ") == 0);
+    assert(server.handleCommand("preset 0 128").compare(0, 6, "error ") == 0);
+    assert(server.handleCommand("property 0 no_such_property 1").compare(0, 6, "error ") == 0);
+
+    // A full queue is reported rather than blocking
+    std::string reply;
+    for (int i = 0; i < 2000 && reply != "error busy"; i++)
+        reply = server.handleCommand("param 0 filter_cutoff 0.5");
+    assert(reply == "error busy");
+    server.applyCommands();
+    assert(server.handleCommand("param 0 filter_cutoff 0.5") == "ok");
+}
+
 #define RUN_TEST(testFunction) do { printf("%s()... ", #testFunction); testFunction(); printf("OK\n"); } while (0)
 
 int main(int argc, const char * argv[])  {
@@ -208,7 +1119,33 @@ int main(int argc, const char * argv[])  {
     RUN_TEST(testMidiOutput_OnOff);
     RUN_TEST(testPresetIgnoredParameters);
     RUN_TEST(testPresetValueStrings);
+    RUN_TEST(testPresetBanksAreShared);
+    RUN_TEST(testSelectPresetRealtime);
+    RUN_TEST(testSelectBankRealtime);
+    RUN_TEST(testSelectBankWithLongPath);
+    RUN_TEST(testBankFileParser);
+    RUN_TEST(testBankValuesParseAsBefore);
+    RUN_TEST(testSaveBank);
+    RUN_TEST(testFailedSaveIsReportedToEveryWaiter);
+#ifdef __linux__
+    RUN_TEST(testBankWatcher);
+#endif
     RUN_TEST(testMidiAllNotesOff);
+    RUN_TEST(testMidiChannelVoices);
+    RUN_TEST(testParameterEvents);
+    RUN_TEST(testSynthStatus);
+    RUN_TEST(testAccumulateOutput);
+    RUN_TEST(testMultitimbral);
+    RUN_TEST(testVoiceBudget);
+    RUN_TEST(testInaudibleVoices);
+    RUN_TEST(testStereoVoices);
+    RUN_TEST(testUnisonSpreadSurvivesOtherParameters);
     RUN_TEST(testOscillatorHighFrequency);
+    RUN_TEST(testUnisonOscillator);
+    RUN_TEST(testFilterMatchesDoubleBiquad);
+    RUN_TEST(testOversampler);
+    RUN_TEST(testTuningMap);
+    RUN_TEST(testMemoryArena);
+    RUN_TEST(testControlServer);
     return 0;
 }